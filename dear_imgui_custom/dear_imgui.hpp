@@ -8,6 +8,8 @@
 
 #include "kisslib/stl_extensions.hpp"
 #include "kisslib/containers.hpp"
+#include "kisslib/threadpool_telemetry.hpp"
+#include "kisslib/arena.hpp"
 #include <vector>
 
 namespace ImGui {
@@ -306,6 +308,85 @@ struct Timing_Histogram {
 	}
 };
 
+#if THREADPOOL_TELEMETRY
+// displays ThreadpoolTelemetry, pass threadpool.telemetry
+// utilization is computed over the last update_period, histograms show totals since the last reset
+struct Threadpool_Telemetry_Display {
+	float update_period = .5f; // sec
+	float update_timer = 0;
+
+	ThreadpoolTelemetry::Snapshot prev, latest;
+	std::vector<float> utilization;
+
+	int imgui_histo_height = 40;
+
+	void update (ThreadpoolTelemetry const& telemetry) {
+		prev = std::move(latest);
+		latest = telemetry.snapshot();
+
+		utilization.assign(latest.workers.size(), 0.0f);
+		for (size_t i=0; i<latest.workers.size() && i<prev.workers.size(); ++i) {
+			float busy = latest.workers[i].busy_sec - prev.workers[i].busy_sec;
+			float idle = latest.workers[i].idle_sec - prev.workers[i].idle_sec;
+			utilization[i] = busy + idle > 0 ? busy / (busy + idle) : 0;
+		}
+	}
+
+	void imgui_display (char const* name, ThreadpoolTelemetry& telemetry, float dt, bool default_open=false) {
+		if (update_timer <= 0) {
+			update(telemetry);
+			update_timer += update_period;
+		}
+		update_timer -= dt;
+
+		float avg_util = 0;
+		for (float u : utilization) avg_util += u;
+		if (!utilization.empty()) avg_util /= (float)utilization.size();
+
+		if (!ImGui::TreeNodeEx(name, default_open ? ImGuiTreeNodeFlags_DefaultOpen : 0,
+			"%12s - %3.0f%% busy", name, avg_util * 100))
+			return;
+
+		ImGui::PushID(name);
+
+		if (ImGui::Button("Reset"))
+			telemetry.reset();
+
+		ImGui::SetNextItemWidth(-1);
+		ImGui::PlotHistogram("##utilization", utilization.data(), (int)utilization.size(), 0, "utilization per thread", 0, 1, ImVec2(0, (float)imgui_histo_height));
+
+		auto histo = [&] (char const* label, char const* id, ThreadpoolTelemetry::Snapshot::HistogramStats const& h) {
+			float buckets[ThreadpoolTelemetry::BUCKETS];
+			float max_count = 1;
+			for (int i=0; i<ThreadpoolTelemetry::BUCKETS; ++i) {
+				buckets[i] = (float)h.buckets[i];
+				max_count = max(max_count, buckets[i]);
+			}
+
+			ImGui::Text("%s: avg %8.3f ms  (%llu jobs)", label, h.avg_sec * 1000, (unsigned long long)h.count);
+			ImGui::SetNextItemWidth(-1);
+			ImGui::PlotHistogram(id, buckets, ThreadpoolTelemetry::BUCKETS, 0, "log2 us", 0, max_count, ImVec2(0, (float)imgui_histo_height));
+		};
+
+		for (auto& t : latest.job_types) {
+			if (ImGui::TreeNodeEx(t.name, ImGuiTreeNodeFlags_DefaultOpen)) {
+				histo("queue wait", "##queue wait", t.wait);
+				histo("run time", "##run time", t.run);
+				ImGui::TreePop();
+			}
+		}
+
+		if (ImGui::BeginPopupContextItem("##telemetry popup")) {
+			ImGui::SliderInt("imgui_histo_height", &imgui_histo_height, 20, 120);
+			ImGui::DragFloat("update_period [s]", &update_period, 0.01f, 0.05f, 5);
+			ImGui::EndPopup();
+		}
+
+		ImGui::PopID();
+		ImGui::TreePop();
+	}
+};
+#endif
 
 struct ValuePlotter {
 	// TODO: use circular buffer with fixed number of items
@@ -356,7 +437,10 @@ struct DistributionPlotter {
 	void plot_distribution (const char* name, int values, FUNC get_value, float xmin, float xmax, bool default_open=true) {
 		if (ImGui::TreeNodeEx(name, default_open ? ImGuiTreeNodeFlags_DefaultOpen : 0)) {
 			
-			std::vector<float> buckets(num_buckets, 0.0f);
+			auto& scratch = get_scratch_arena();
+			ArenaScope scope(scratch);
+
+			arena_vector<float> buckets(num_buckets, 0.0f, scratch);
 			
 			for (int i=0; i<values; ++i) {
 				float val = get_value(i);
@@ -9,6 +9,11 @@
 #include "opengl.hpp"
 #include "GLFW/glfw3.h"
 
+#include "kisslib/coroutine_task.hpp"
+#include "kisslib/threadpool.hpp"
+#include "kisslib/tlsf_allocator.hpp"
+#include "kisslib/timer.hpp"
+
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include "GLFW/glfw3native.h"
 
@@ -17,15 +22,33 @@ inline constexpr int2 MIN_WINDOW_SIZE = 128;
 inline int _vsync_on_interval = 1;
 void Engine::set_vsync (bool vsync) {
 	this->vsync = vsync;
-	glfwSwapInterval(vsync ? _vsync_on_interval : 0);
+	// GL context belongs to the render thread, which applies the interval from the frame packet
+	if (!_render_thread.joinable())
+		glfwSwapInterval(vsync ? _vsync_on_interval : 0);
 }
 
 //// Imgui stuff
+// imgui memory counts as MEMTAG_UI, free does not get the size, so it is stored in front of the allocation
+static void* imgui_alloc (size_t size, void* user_data) {
+	auto* ptr = (char*)malloc(size + 16);
+	if (!ptr) return nullptr;
+	*(size_t*)ptr = size;
+	MEMTRACK_ALLOC(MEMTAG_UI, size);
+	return ptr + 16;
+}
+static void imgui_free (void* ptr, void* user_data) {
+	if (!ptr) return;
+	char* base = (char*)ptr - 16;
+	MEMTRACK_FREE(MEMTAG_UI, *(size_t*)base);
+	free(base);
+}
+
 void imgui_setup (Engine& eng) {
 	ZoneScoped;
 
 	// Setup Dear ImGui context
 	IMGUI_CHECKVERSION();
+	ImGui::SetAllocatorFunctions(imgui_alloc, imgui_free);
 	ImGui::CreateContext();
 	ImGuiIO& io = ImGui::GetIO();
 	io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;
@@ -59,20 +82,106 @@ void imgui_begin_frame (Engine& eng) {
 
 	ImGui::NewFrame();
 }
-void imgui_end_frame (Engine& eng) {
-	ZoneScoped;
-
-	ImGui::Render();
-
+void imgui_render_draw_data (ImDrawData* draw_data, bool imgui_enabled) {
 	if (GLAD_GL_ARB_framebuffer_sRGB)
 		glDisable(GL_FRAMEBUFFER_SRGB);
 
-	if (eng.imgui_enabled)
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	if (imgui_enabled)
+		ImGui_ImplOpenGL3_RenderDrawData(draw_data);
 	
 	if (GLAD_GL_ARB_framebuffer_sRGB)
 		glEnable(GL_FRAMEBUFFER_SRGB);
 }
+void imgui_end_frame (Engine& eng) {
+	ZoneScoped;
+
+	ImGui::Render();
+
+	imgui_render_draw_data(ImGui::GetDrawData(), eng.imgui_enabled);
+}
+
+// copy ImGui draw data into the frame packet, so that the render thread can draw it while the main thread builds the next ImGui frame
+void imgui_copy_draw_data (Engine::FramePacket& packet, ImDrawData const* src) {
+	ZoneScoped;
+
+	auto& lists = packet._imgui_lists;
+	while ((int)lists.size() < src->CmdListsCount)
+		lists.push_back(IM_NEW(ImDrawList)(ImGui::GetDrawListSharedData()));
+
+	packet.imgui_draw_data = *src;
+
+	for (int i=0; i<src->CmdListsCount; ++i) {
+		ImDrawList const* s = src->CmdLists[i];
+		ImDrawList* d = lists[i];
+		// ImVector assignment reuses the capacity of the previous frames
+		d->CmdBuffer = s->CmdBuffer;
+		d->IdxBuffer = s->IdxBuffer;
+		d->VtxBuffer = s->VtxBuffer;
+		d->Flags = s->Flags;
+
+		packet.imgui_draw_data.CmdLists[i] = d;
+	}
+}
+
+Engine::FramePacket::~FramePacket () {
+	for (auto* list : _imgui_lists)
+		IM_DELETE(list);
+}
+
+void imgui_memory_budgets () {
+	auto& mem = g_mem_tracker;
+
+#if !MEMORY_TRACKING
+	ImGui::TextDisabled("compile with MEMORY_TRACKING=1 to track allocations");
+#endif
+
+	if (ImGui::BeginTable("memory", 6, ImGuiTableFlags_SizingStretchProp | ImGuiTableFlags_RowBg)) {
+		ImGui::TableSetupColumn("tag");
+		ImGui::TableSetupColumn("live MB");
+		ImGui::TableSetupColumn("peak MB");
+		ImGui::TableSetupColumn("budget MB");
+		ImGui::TableSetupColumn("allocs/s");
+		ImGui::TableSetupColumn("outstanding");
+		ImGui::TableHeadersRow();
+
+		for (int i=0; i<MEMTAG_COUNT; ++i) {
+			auto& c = mem.tags[i];
+			ImGui::PushID(i);
+			ImGui::TableNextRow();
+
+			if (mem.over_budget[i])
+				ImGui::PushStyleColor(ImGuiCol_Text, 0xFF3030FF);
+
+			ImGui::TableNextColumn();
+			ImGui::Text("%s", MEMTAG_NAMES[i]);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", (float)c.live_bytes.load(std::memory_order_relaxed) / (float)MB);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.2f", (float)c.peak_bytes.load(std::memory_order_relaxed) / (float)MB);
+
+			if (mem.over_budget[i])
+				ImGui::PopStyleColor();
+
+			// soft limit, 0 -> none
+			ImGui::TableNextColumn();
+			float budget = (float)mem.budgets[i] / (float)MB;
+			ImGui::SetNextItemWidth(-1);
+			if (ImGui::DragFloat("##budget", &budget, 1, 0, 1024*16, "%.0f"))
+				mem.budgets[i] = (size_t)(max(budget, 0.0f) * (float)MB);
+
+			ImGui::TableNextColumn();
+			ImGui::Text("%.0f", mem.alloc_rate[i]);
+			ImGui::TableNextColumn();
+			ImGui::Text("%lld", (long long)c.outstanding());
+
+			ImGui::PopID();
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::Button("Reset peaks"))
+		mem.reset_peaks();
+}
 
 void do_imgui (Engine& eng) {
 	if (!eng.imgui_enabled)
@@ -136,11 +245,39 @@ void do_imgui (Engine& eng) {
 			if (imgui_Header("Performance", true)) {
 				eng.fps_display.push_timing(eng.input.real_dt);
 				eng.fps_display.imgui_display("framerate", eng.input.real_dt, true);
+
+				if (eng.pipelined) {
+					// with both below the frametime, update and render overlap
+					eng.update_timing.imgui_display("update", eng.input.real_dt);
+					eng.render_timing.imgui_display("render", eng.input.real_dt);
+				}
+
+				ImGui::Text("frame arena: %.2f MB (max %.2f MB)",
+					(float)g_frame_arena.last_frame_peak / (float)MB, (float)g_frame_arena.max_frame_peak / (float)MB);
+
+				if (eng.fixed.enabled) {
+					eng.fixed.tick_timing.imgui_display("fixed tick", eng.input.real_dt);
+
+					float rate = eng.fixed.rate;
+					if (ImGui::DragFloat("tick rate", &rate, 0.1f, 1, 1000, "%.1f hz"))
+						eng.fixed.rate = rate;
+					int max_ticks = eng.fixed.max_ticks;
+					if (ImGui::SliderInt("max ticks", &max_ticks, 1, 20))
+						eng.fixed.max_ticks = max_ticks;
+					ImGui::Text("ticks: %llu  this frame: %d  dropped: %llu  alpha: %.2f",
+						(unsigned long long)eng.fixed.tick_counter.load(), eng.fixed.ticks_this_frame,
+						(unsigned long long)eng.fixed.dropped_ticks.load(), eng.fixed.alpha);
+				}
 			
 				//ImGui::Text("Chunks drawn %4d / %4d", world->chunks.chunks.count() - world->chunks.count_culled, world->chunks.chunks.count());
 				ImGui::PopID();
 			}
 
+			if (imgui_Header("Memory")) {
+				imgui_memory_budgets();
+				ImGui::PopID();
+			}
+
 			eng.input.imgui();
 
 			// Game imgui
@@ -312,19 +449,7 @@ void window_shutdown (Engine& eng) {
 	glfwTerminate();
 }
 
-void update_files_changed (Engine& eng) {
-	ZoneScopedN("update_files_changed");
-	
-	// could poll this less frequently if it were to block the main thread significantly
-	// but that would just cause stutter every N frames
-	// if the OS were that bad I would be forced to run this in a background thread instead
-	
-	kiss::ChangedFiles changed_files;
-	{
-		ZoneScopedN("file_changes.poll_changes()");
-		changed_files = eng.file_changes.poll_changes();
-	}
-	
+void update_files_changed (Engine& eng, kiss::ChangedFiles& changed_files) {
 	if (changed_files.any()) {
 		ZoneScopedN("file change detected");
 		
@@ -350,6 +475,20 @@ void update_files_changed (Engine& eng) {
 		//}
 	}
 }
+kiss::ChangedFiles poll_files_changed (Engine& eng) {
+	ZoneScopedN("file_changes.poll_changes()");
+	
+	// could poll this less frequently if it were to block the main thread significantly
+	// but that would just cause stutter every N frames
+	// if the OS were that bad I would be forced to run this in a background thread instead
+	return eng.file_changes.poll_changes();
+}
+void update_files_changed (Engine& eng) {
+	ZoneScopedN("update_files_changed");
+	
+	kiss::ChangedFiles changed_files = poll_files_changed(eng);
+	update_files_changed(eng, changed_files);
+}
 
 //// fullscreen mode
 struct Monitor {
@@ -637,6 +776,273 @@ void pause_while_window_not_visible (Engine& eng) {
 	}
 }
 
+//// Fixed timestep
+
+void run_fixed_tick (Engine& eng) {
+	ZoneScopedN("fixed_update");
+	auto timer = kiss::Timer::start();
+
+	eng.fixed_update(eng.fixed.dt(), eng.fixed.input);
+
+	eng.fixed.tick_counter.fetch_add(1, std::memory_order_relaxed);
+	eng.fixed._last_tick_time.store(timer.end(), std::memory_order_relaxed);
+}
+
+// called every frame, runs due ticks in serial mode, only computes alpha in threaded mode
+void fixed_timestep_frame (Engine& eng) {
+	auto& f = eng.fixed;
+	if (!f.enabled) return;
+
+	if (f._thread.joinable()) {
+		{
+			std::lock_guard lock(f.mutex);
+			f.input = eng.input;
+		}
+
+		uint64_t since_tick = kiss::get_timestamp() - f._last_tick_ts.load(std::memory_order_acquire);
+		f.alpha = clamp((float)since_tick / (float)kiss::timestamp_freq * f.rate, 0.0f, 1.0f);
+		f.tick_timing.push_timing(f._last_tick_time.load(std::memory_order_relaxed));
+		return;
+	}
+
+	f.input = eng.input;
+
+	float dt = f.dt();
+	int max_ticks = f.max_ticks.load(std::memory_order_relaxed);
+	f._accumulator += eng.input.real_dt;
+
+	int ticks = 0;
+	while (f._accumulator >= dt) {
+		if (ticks >= max_ticks) {
+			// can't keep up, drop the remaining time
+			int dropped = (int)(f._accumulator / dt);
+			f.dropped_ticks.fetch_add(dropped, std::memory_order_relaxed);
+			f._accumulator -= (float)dropped * dt;
+			break;
+		}
+
+		run_fixed_tick(eng);
+		f.tick_timing.push_timing(f._last_tick_time.load(std::memory_order_relaxed));
+
+		f._accumulator -= dt;
+		ticks++;
+	}
+
+	f.ticks_this_frame = ticks;
+	f.alpha = clamp(f._accumulator / dt, 0.0f, 1.0f);
+}
+
+void fixed_timestep_thread_main (Engine& eng) {
+	set_thread_priority(TPRIO_MAIN);
+	set_thread_description("fixed timestep");
+	// set explicitly instead of inheriting whatever affinity the starting thread has
+	// keeps off MAIN_THREAD_CORE like the render thread, mostly sleeps between ticks
+	set_thread_excluded_core(MAIN_THREAD_CORE);
+
+	auto& f = eng.fixed;
+
+	uint64_t next_tick = kiss::get_timestamp();
+	f._last_tick_ts.store(next_tick, std::memory_order_relaxed);
+
+	while (!f._thread_exit.load(std::memory_order_relaxed)) {
+		uint64_t period = (uint64_t)((float)kiss::timestamp_freq / f.rate.load(std::memory_order_relaxed));
+		int max_ticks = f.max_ticks.load(std::memory_order_relaxed);
+		uint64_t now = kiss::get_timestamp();
+
+		if (now < next_tick) {
+			kiss::sleep_until(next_tick);
+			continue;
+		}
+
+		int ticks = 0;
+		while (now >= next_tick && ticks < max_ticks) {
+			{
+				std::lock_guard lock(f.mutex);
+				run_fixed_tick(eng);
+			}
+			f._last_tick_ts.store(next_tick, std::memory_order_release);
+
+			next_tick += period;
+			ticks++;
+			now = kiss::get_timestamp();
+		}
+
+		if (now >= next_tick) {
+			// can't keep up, drop the remaining time
+			uint64_t dropped = (now - next_tick) / period + 1;
+			f.dropped_ticks.fetch_add(dropped, std::memory_order_relaxed);
+			next_tick += dropped * period;
+		}
+	}
+}
+
+void start_fixed_timestep_thread (Engine& eng) {
+	eng.fixed._thread_exit = false;
+	eng.fixed._thread = std::thread(fixed_timestep_thread_main, std::ref(eng));
+}
+void stop_fixed_timestep_thread (Engine& eng) {
+	eng.fixed._thread_exit = true;
+	eng.fixed._thread.join();
+}
+
+//// Pipelined mode
+// frame N is recorded into _packets[N % FRAME_PACKETS] by the main thread and rendered by the render thread
+// the main thread can only start recording frame N once frame N-FRAME_PACKETS is rendered, so the render thread lags at most one frame behind
+
+void wait_for_frames (std::atomic<uint64_t>& frames, uint64_t target) {
+	for (;;) {
+		uint64_t cur = frames.load(std::memory_order_acquire);
+		if (cur >= target)
+			return;
+		frames.wait(cur, std::memory_order_acquire);
+	}
+}
+
+void render_thread_main (Engine& eng) {
+	set_thread_priority(TPRIO_MAIN);
+	set_thread_description("render thread");
+	// keep off MAIN_THREAD_CORE, else it can't render frame N while the main thread updates frame N+1
+	// TPRIO_MAIN preempts the TPRIO_PARALLELISM threads pinned to the other cores
+	set_thread_excluded_core(MAIN_THREAD_CORE);
+
+	glfwMakeContextCurrent(eng.window);
+
+	int swap_interval = -1;
+
+	for (uint64_t frame = 1;; ++frame) {
+		{
+			ZoneScopedN("wait for update");
+			// wait for the frame or for exit, exit only once all submitted frames are rendered
+			for (;;) {
+				uint64_t cur = eng._submitted_frames.load(std::memory_order_acquire);
+				if (cur >= frame)
+					break;
+				if (eng._render_thread_exit.load(std::memory_order_acquire)) {
+					glfwMakeContextCurrent(nullptr);
+					return;
+				}
+				eng._submitted_frames.wait(cur, std::memory_order_acquire);
+			}
+		}
+		
+		auto timer = kiss::Timer::start();
+
+		eng.render_packet_idx = (int)(frame % Engine::FRAME_PACKETS);
+		auto& packet = eng.render_packet();
+
+		if (packet.swap_interval != swap_interval) {
+			swap_interval = packet.swap_interval;
+			glfwSwapInterval(swap_interval);
+		}
+
+		update_files_changed(eng, packet.changed_files);
+
+		ImGui_ImplOpenGL3_NewFrame(); // creates device objects on first use
+
+		{
+			ZoneScopedN("render");
+			eng.render();
+		}
+
+		eng._last_render_time.store(timer.end(), std::memory_order_relaxed);
+
+		{
+			ZoneScopedN("glfwSwapBuffers");
+			glfwSwapBuffers(eng.window);
+		}
+
+		TracyGpuCollect;
+
+		eng._rendered_frames.store(frame, std::memory_order_release);
+		eng._rendered_frames.notify_all();
+	}
+}
+
+void start_render_thread (Engine& eng) {
+	// ImGui::NewFrame on the main thread needs the font atlas, which is built when the backend creates it's device objects
+	ImGui_ImplOpenGL3_NewFrame();
+
+	// hand the GL context to the render thread
+	glfwMakeContextCurrent(nullptr);
+
+	eng._render_thread_exit = false;
+	eng._render_thread = std::thread(render_thread_main, std::ref(eng));
+}
+void stop_render_thread (Engine& eng) {
+	eng._render_thread_exit.store(true, std::memory_order_release);
+	eng._submitted_frames.notify_all();
+	eng._render_thread.join();
+
+	// engine shutdown needs the context again
+	glfwMakeContextCurrent(eng.window);
+}
+
+void pipelined_update (Engine& eng) {
+	uint64_t frame = eng._submitted_frames.load(std::memory_order_relaxed) + 1;
+
+	{
+		ZoneScopedN("wait for render");
+		// packet slot is free once the frame that used it before was rendered
+		if (frame > Engine::FRAME_PACKETS)
+			wait_for_frames(eng._rendered_frames, frame - Engine::FRAME_PACKETS);
+	}
+
+	// only now, the render thread might have still been reading frame arena memory of frame-2
+	g_frame_arena.begin_frame();
+
+	auto timer = kiss::Timer::start();
+
+	eng.update_packet_idx = (int)(frame % Engine::FRAME_PACKETS);
+	auto& packet = eng.update_packet();
+
+	packet.changed_files = poll_files_changed(eng);
+
+	// coroutines that did co_await kiss::next_frame()
+	kiss::resume_main_thread_coroutines();
+
+	{ // no ImGui_ImplOpenGL3_NewFrame, that happens on the render thread
+		ZoneScopedN("imgui_begin_frame");
+		ImGui_ImplGlfw_NewFrame(eng.imgui_enabled && eng.input.cursor_enabled);
+
+		auto& io = ImGui::GetIO();
+		io.ConfigWindowsMoveFromTitleBarOnly = true;
+		if (io.WantCaptureKeyboard)
+			eng.input.disable_keyboard();
+		if (io.WantCaptureMouse)
+			eng.input.disable_mouse();
+
+		ImGui::NewFrame();
+	}
+
+	fixed_timestep_frame(eng);
+
+	do_imgui(eng);
+
+	{
+		ZoneScopedN("update");
+		eng.update();
+	}
+
+	ImGui::Render();
+	imgui_copy_draw_data(packet, ImGui::GetDrawData());
+
+	// hand the recorded debug draw to the render thread and give the game the vectors of the already rendered packet
+	std::swap(packet.dbgdraw.lines, g_dbgdraw.lines);
+	std::swap(packet.dbgdraw.tris, g_dbgdraw.tris);
+	g_dbgdraw.clear();
+
+	packet.frame_counter = eng.input.frame_counter;
+	packet.window_size = eng.input.window_size;
+	packet.swap_interval = eng.vsync ? _vsync_on_interval : 0;
+	packet.imgui_enabled = eng.imgui_enabled;
+
+	eng.update_timing.push_timing(timer.end());
+	eng.render_timing.push_timing(eng._last_render_time.load(std::memory_order_relaxed));
+
+	eng._submitted_frames.store(frame, std::memory_order_release);
+	eng._submitted_frames.notify_all();
+}
+
 ////
 void window_frame (Engine& eng) {
 	pause_while_window_not_visible(eng);
@@ -645,17 +1051,40 @@ void window_frame (Engine& eng) {
 
 	glfw_sample_non_callback_input(eng);
 
-	update_files_changed(eng);
+	int over_budget = g_mem_tracker.update(eng.input.real_dt);
+	if (over_budget >= 0) {
+		clog(WARNING, "[Memory] %s over budget: %.1f MB / %.1f MB", MEMTAG_NAMES[over_budget],
+			(float)g_mem_tracker.tags[over_budget].live_bytes.load() / (float)MB, (float)g_mem_tracker.budgets[over_budget] / (float)MB);
+	}
 
-	imgui_begin_frame(eng);
+	// TlsfAllocator only applies it's RetentionPolicy on frees that reach the top, so memory that stays retained needs this to ever be decommitted
+	decay_default_tlsf_allocator();
 
-	do_imgui(eng);
+	bool pipelined = eng._render_thread.joinable(); // not eng.pipelined, which only takes effect when main_loop starts
 
-	eng.frame();
+	if (pipelined) {
+		pipelined_update(eng);
+	}
+	else {
+		g_frame_arena.begin_frame();
 
-	{
-		ZoneScopedN("glfwSwapBuffers");
-		glfwSwapBuffers(eng.window);
+		update_files_changed(eng);
+
+		// coroutines that did co_await kiss::next_frame()
+		kiss::resume_main_thread_coroutines();
+
+		imgui_begin_frame(eng);
+
+		fixed_timestep_frame(eng);
+
+		do_imgui(eng);
+
+		eng.frame();
+
+		{
+			ZoneScopedN("glfwSwapBuffers");
+			glfwSwapBuffers(eng.window);
+		}
 	}
 
 	eng.input.clear_frame_input();
@@ -665,12 +1094,16 @@ void window_frame (Engine& eng) {
 
 	eng.input.frame_counter++;
 
-
-	TracyGpuCollect;
+	if (!pipelined)
+		TracyGpuCollect;
 }
 
+// call from frame() or render()
 void Engine::draw_imgui () {
-	imgui_end_frame(*this);
+	if (_render_thread.joinable())
+		imgui_render_draw_data(&render_packet().imgui_draw_data, render_packet().imgui_enabled);
+	else
+		imgui_end_frame(*this);
 }
 
 void clear_window_color (GLFWwindow* window) {
@@ -724,6 +1157,15 @@ int Engine::main_loop () {
 	json_load();
 	
 	glfw_input_pre_gameloop(*this);
+
+	if (pipelined)
+		start_render_thread(*this);
+	if (fixed.enabled && fixed.threaded)
+		start_fixed_timestep_thread(*this);
+
+	// threadpool threads keep off MAIN_THREAD_CORE, so run the main thread there
+	// only after starting the threads above, new threads inherit the affinity of the thread creating them
+	set_thread_preferred_core(MAIN_THREAD_CORE);
 	
 	while (_should_close != CLOSE_NOW) {
 		{
@@ -742,6 +1184,11 @@ int Engine::main_loop () {
 		window_frame(*this);
 	}
 
+	if (fixed._thread.joinable())
+		stop_fixed_timestep_thread(*this);
+	if (pipelined)
+		stop_render_thread(*this);
+
 	return 0;
 }
 
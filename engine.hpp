@@ -2,10 +2,56 @@
 #include "common.hpp"
 #include "kisslib/kissmath.hpp"
 #include "input.hpp"
+#include "agnostic_render.hpp"
+#include "kisslib/arena.hpp"
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 struct GLFWwindow;
 struct GLFWcursor;
 
+// memory for the current frame, valid until the end of the next frame, reset in window_frame
+// use for per-frame arrays instead of std::vector, ie. arena_vector<T> vec(g_frame_arena.current())
+inline FrameArena g_frame_arena (1*GB);
+
+// Fixed timestep simulation (optional), set enabled and implement Engine::fixed_update()
+// ticks run at a fixed rate independent of the framerate, render with state interpolated by alpha
+struct FixedTimestep {
+	bool		enabled = false;
+	// simulation ticks per second (atomic since the tick thread reads it while imgui can change it)
+	std::atomic<float>	rate = 60;
+	// run ticks on their own thread instead of before each frame, so that heavy ticks don't stall rendering
+	//  only takes effect when main_loop starts
+	//  fixed_update() is called with mutex locked, lock it in update()/frame() while copying the state to render
+	bool		threaded = false;
+	// spiral of death guard: at most this many ticks are run to catch up, time beyond that is dropped (simulation slows down instead)
+	std::atomic<int>	max_ticks = 5;
+
+	// [0,1] how far the current frame is between the last tick and the next, lerp(prev_state, state, alpha)
+	float		alpha = 0;
+	int			ticks_this_frame = 0; // serial mode only
+
+	std::atomic<uint64_t>	tick_counter = 0;
+	std::atomic<uint64_t>	dropped_ticks = 0;
+
+	std::mutex				mutex;
+
+	// copy of Engine::input passed to fixed_update(), taken once per frame under mutex
+	// so that threaded ticks never see the input while the main thread updates it
+	Input					input = {};
+
+	float dt () const { return 1.0f / rate.load(std::memory_order_relaxed); }
+
+	float					_accumulator = 0;
+	std::thread				_thread;
+	std::atomic<bool>		_thread_exit = false;
+	std::atomic<uint64_t>	_last_tick_ts = 0; // scheduled time of the last tick
+	std::atomic<float>		_last_tick_time = 0;
+
+	Timing_Histogram		tick_timing;
+};
+
 class Engine {
 public:
 
@@ -81,7 +127,78 @@ public:
 	void set_cursor (CursorMode mode);
 
 	virtual void imgui () = 0;
-	virtual void frame () = 0;
+
+	FixedTimestep fixed;
+
+	// called fixed.rate times per second when fixed.enabled, before imgui() and frame()/update() of the frame
+	// input is a snapshot of the input of the latest frame, so all ticks in one frame see the same input
+	//  use it instead of Engine::input, which the main thread writes while threaded ticks run
+	virtual void fixed_update (float fixed_dt, Input const& input) {}
+
+	// serial mode: called once per frame, does all update and rendering
+	// games that support pipelined mode implement update() and render() instead
+	virtual void frame () {
+		update();
+		render();
+	}
+
+	//// Pipelined mode (optional)
+	// set pipelined = true before main_loop() to render frame N on a render thread while the main thread updates frame N+1
+	// the render thread owns the GL context, so in pipelined mode:
+	//  update() runs on the main thread and must not make GL calls, it records what is needed to render the frame
+	//  render() runs on the render thread and must only read what update() recorded for that frame
+	//   double-buffer that data by indexing with update_packet_idx in update() and render_packet_idx in render()
+	//  update_files_changed() is called on the render thread, before render() of the frame the changes were detected in
+	bool pipelined = false;
+
+	// simulate the frame
+	virtual void update () {}
+	// render the frame recorded by update()
+	virtual void render () {}
+
+	// engine data that crosses from update to render, double-buffered like game data should be
+	struct FramePacket {
+		uint64_t		frame_counter = 0;
+		int2			window_size = 0;
+		int				swap_interval = 1;
+		bool			imgui_enabled = true;
+
+		// g_dbgdraw as recorded during update(), draw this instead of g_dbgdraw in render() (see dbgdraw_for_render())
+		render::DebugDraw dbgdraw;
+
+		kiss::ChangedFiles changed_files;
+
+		// copy of ImGui draw data, draw lists are owned by the packet and reused across frames
+		ImDrawData					imgui_draw_data;
+		std::vector<ImDrawList*>	_imgui_lists;
+
+		FramePacket () {}
+		~FramePacket ();
+		FramePacket (FramePacket const&) = delete;
+		FramePacket& operator= (FramePacket const&) = delete;
+	};
+	static constexpr int FRAME_PACKETS = 2;
+	FramePacket _packets[FRAME_PACKETS];
+
+	int update_packet_idx = 0;
+	int render_packet_idx = 0;
+
+	FramePacket& update_packet () { return _packets[update_packet_idx]; }
+	FramePacket& render_packet () { return _packets[render_packet_idx]; }
+
+	render::DebugDraw& dbgdraw_for_render () {
+		return pipelined ? render_packet().dbgdraw : g_dbgdraw;
+	}
+
+	std::thread				_render_thread;
+	std::atomic<uint64_t>	_submitted_frames = 0; // frames recorded by update()
+	std::atomic<uint64_t>	_rendered_frames = 0;  // frames rendered and swapped
+	std::atomic<bool>		_render_thread_exit = false;
+
+	// time spent per frame excluding waiting for the other thread
+	Timing_Histogram update_timing;
+	Timing_Histogram render_timing;
+	std::atomic<float> _last_render_time = 0; // written by render thread
 
 	virtual bool update_files_changed (kiss::ChangedFiles& changed_files) = 0;
 
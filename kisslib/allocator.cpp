@@ -1,8 +1,11 @@
 #include "allocator.hpp"
-#include "clean_windows_h.hpp"
 
 ////// Platform specific code
 
+#ifdef _WIN32
+#include "clean_windows_h.hpp"
+#include <winioctl.h>
+
 uint32_t get_os_page_size () {
 	SYSTEM_INFO info;
 	GetSystemInfo(&info);
@@ -11,12 +14,40 @@ uint32_t get_os_page_size () {
 }
 
 //// VirtualAlloc
-void* reserve_address_space (size_t size) {
+// large_pages only changes the alignment here, MEM_LARGE_PAGES needs SeLockMemoryPrivilege and has to be committed at reserve time,
+// which does not fit reserve-then-commit-on-demand
+// VirtualAlloc only aligns to the 64KB allocation granularity, and a reservation can only be released as a whole (unlike munmap)
+// so over-reserve to find a LARGE_PAGE_SIZE aligned address, release it and reserve again exactly there
+// another thread can reserve the range in between, in which case we simply retry
+void* reserve_address_space (size_t size, bool large_pages) {
 	ALLOCATOR_PROFILE_SCOPED("reserve_address_space");
 
-	void* baseptr = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
-	assert(baseptr != nullptr);
-	return baseptr;
+	if (!large_pages) {
+		void* baseptr = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+		assert(baseptr != nullptr);
+		return baseptr;
+	}
+
+	assert(size % LARGE_PAGE_SIZE == 0);
+
+	for (int attempt=0; attempt<16; ++attempt) {
+		char* ptr = (char*)VirtualAlloc(NULL, size + LARGE_PAGE_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+		assert(ptr != nullptr);
+		if (!ptr)
+			return nullptr;
+
+		char* aligned = (char*)( ((uintptr_t)ptr + (LARGE_PAGE_SIZE-1)) & ~(uintptr_t)(LARGE_PAGE_SIZE-1) );
+		VirtualFree(ptr, 0, MEM_RELEASE);
+
+		void* baseptr = VirtualAlloc(aligned, size, MEM_RESERVE, PAGE_NOACCESS);
+		if (baseptr) {
+			assert(baseptr == aligned);
+			return baseptr;
+		}
+	}
+
+	assert(false);
+	return nullptr;
 }
 
 void release_address_space (void* baseptr, size_t size) {
@@ -36,10 +67,66 @@ void commit_pages (void* ptr, size_t size) {
 void decommit_pages (void* ptr, size_t size) {
 	ALLOCATOR_PROFILE_SCOPED("decommit_pages");
 
+	if (_decommit_hook)
+		_decommit_hook(ptr, size);
+
 	auto ret = VirtualFree(ptr, size, MEM_DECOMMIT);
 	assert(ret != 0);
 }
 
+//// File mapping
+bool map_file (char const* filename, size_t size, MappedFile* file, bool* existed) {
+	ALLOCATOR_PROFILE_SCOPED("map_file");
+
+	HANDLE handle = CreateFileA(filename, GENERIC_READ|GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	*existed = GetFileSizeEx(handle, &file_size) && file_size.QuadPart > 0;
+
+	// CreateFileMapping grows the file to size, sparse so that only written parts use disk space
+	DWORD bytes;
+	DeviceIoControl(handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+	if (!mapping) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!base) {
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file->base = (char*)base;
+	file->size = size;
+	file->handle = (intptr_t)handle;
+	file->mapping = (intptr_t)mapping;
+	return true;
+}
+
+void unmap_file (MappedFile& file) {
+	ALLOCATOR_PROFILE_SCOPED("unmap_file");
+
+	UnmapViewOfFile(file.base);
+	CloseHandle((HANDLE)file.mapping);
+	CloseHandle((HANDLE)file.handle);
+	file = {};
+}
+
+void flush_mapped_file (MappedFile& file, void* ptr, size_t size) {
+	ALLOCATOR_PROFILE_SCOPED("flush_mapped_file");
+
+	auto ret = FlushViewOfFile(ptr, size);
+	assert(ret != 0);
+	ret = FlushFileBuffers((HANDLE)file.handle);
+	assert(ret != 0);
+}
+
 //// AllocatorBitset
 uint32_t _bsf_1 (uint64_t val) {
 	unsigned long idx;
@@ -54,3 +141,150 @@ uint32_t _bsr_0 (uint64_t val) {
 	return idx;
 }
 
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+uint32_t get_os_page_size () {
+	return (uint32_t)sysconf(_SC_PAGESIZE);
+}
+
+//// mmap
+// reserved memory is mapped PROT_NONE, commit makes it read-write, decommit drops the pages and makes it PROT_NONE again
+// MAP_NORESERVE so that reserving multiple GB does not count against overcommit limits, only committed pages use memory
+
+// with large_pages the region is 2MB aligned and marked MADV_HUGEPAGE, so page faults in committed 2MB ranges
+// get transparent huge pages (if /sys/kernel/mm/transparent_hugepage/enabled is not 'never')
+// with ALLOCATOR_HUGETLB=1 explicit MAP_HUGETLB pages are tried first, which need pages reserved in /proc/sys/vm/nr_hugepages
+//  (commit does not fail if the pool runs out, the page fault raises SIGBUS instead, so only use this with a sized pool)
+void* reserve_address_space (size_t size, bool large_pages) {
+	ALLOCATOR_PROFILE_SCOPED("reserve_address_space");
+
+	if (!large_pages) {
+		void* baseptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		assert(baseptr != MAP_FAILED);
+		return baseptr != MAP_FAILED ? baseptr : nullptr;
+	}
+
+	assert(size % LARGE_PAGE_SIZE == 0);
+
+#if ALLOCATOR_HUGETLB
+	{
+		void* baseptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_HUGETLB, -1, 0);
+		if (baseptr != MAP_FAILED)
+			return baseptr;
+		// no hugetlbfs support, fall back to transparent huge pages
+	}
+#endif
+
+	// over-reserve and unmap the unaligned head and tail to get 2MB alignment
+	size_t padded = size + LARGE_PAGE_SIZE;
+	char* ptr = (char*)mmap(NULL, padded, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	assert(ptr != MAP_FAILED);
+	if (ptr == MAP_FAILED)
+		return nullptr;
+
+	char* baseptr = (char*)( ((uintptr_t)ptr + (LARGE_PAGE_SIZE-1)) & ~(uintptr_t)(LARGE_PAGE_SIZE-1) );
+	if (baseptr > ptr)
+		munmap(ptr, baseptr - ptr);
+	if (baseptr + size < ptr + padded)
+		munmap(baseptr + size, (ptr + padded) - (baseptr + size));
+
+	// madvise flags are kept by mprotect, so this only needs to happen once
+	madvise(baseptr, size, MADV_HUGEPAGE); // fails harmlessly if THP is not compiled in
+	return baseptr;
+}
+
+void release_address_space (void* baseptr, size_t size) {
+	ALLOCATOR_PROFILE_SCOPED("release_address_space");
+
+	auto ret = munmap(baseptr, size);
+	assert(ret == 0);
+}
+
+void commit_pages (void* ptr, size_t size) {
+	ALLOCATOR_PROFILE_SCOPED("commit_pages");
+
+	// pages are only actually allocated (zeroed) on first access like with VirtualAlloc
+	auto ret = mprotect(ptr, size, PROT_READ|PROT_WRITE);
+	assert(ret == 0);
+}
+
+void decommit_pages (void* ptr, size_t size) {
+	ALLOCATOR_PROFILE_SCOPED("decommit_pages");
+
+	if (_decommit_hook)
+		_decommit_hook(ptr, size);
+
+	// MADV_DONTNEED instead of MADV_FREE: MADV_FREE lets the kernel keep the old contents until it needs the memory,
+	// but allocators rely on recommitted memory being zero like after MEM_DECOMMIT
+	auto ret = madvise(ptr, size, MADV_DONTNEED);
+	assert(ret == 0);
+	ret = mprotect(ptr, size, PROT_NONE);
+	assert(ret == 0);
+}
+
+//// File mapping
+bool map_file (char const* filename, size_t size, MappedFile* file, bool* existed) {
+	ALLOCATOR_PROFILE_SCOPED("map_file");
+
+	int fd = open(filename, O_RDWR|O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	*existed = fstat(fd, &st) == 0 && st.st_size > 0;
+
+	// ftruncate creates a sparse file, only written parts use disk space
+	if (!*existed || (size_t)st.st_size < size) {
+		if (ftruncate(fd, (off_t)size) != 0) {
+			close(fd);
+			return false;
+		}
+	}
+
+	void* base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	file->base = (char*)base;
+	file->size = size;
+	file->handle = fd;
+	return true;
+}
+
+void unmap_file (MappedFile& file) {
+	ALLOCATOR_PROFILE_SCOPED("unmap_file");
+
+	munmap(file.base, file.size);
+	close((int)file.handle);
+	file = {};
+}
+
+void flush_mapped_file (MappedFile& file, void* ptr, size_t size) {
+	ALLOCATOR_PROFILE_SCOPED("flush_mapped_file");
+
+	(void)file; // msync works on the mapping, unlike FlushFileBuffers on windows
+
+	// msync needs a page aligned start
+	char* begin = (char*)((uintptr_t)ptr & ~(uintptr_t)(os_page_size-1));
+	auto ret = msync(begin, (char*)ptr + size - begin, MS_SYNC);
+	assert(ret == 0);
+	(void)ret;
+}
+
+//// AllocatorBitset
+uint32_t _bsf_1 (uint64_t val) {
+	assert(val != 0);
+	return (uint32_t)__builtin_ctzll(val);
+}
+uint32_t _bsr_0 (uint64_t val) {
+	assert(~val != 0);
+	return 63 - (uint32_t)__builtin_clzll(~val);
+}
+
+#endif
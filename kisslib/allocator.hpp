@@ -5,6 +5,13 @@
 #include <vector>
 #include "stl_extensions.hpp"
 #include <stdexcept>
+#include <type_traits>
+#include <cstring>
+#include "timer.hpp"
+#include "memory_tracking.hpp"
+#if defined(__AVX2__) || defined(__SSE4_1__)
+	#include <immintrin.h>
+#endif
 
 /*
 	Allocators implemented using OS-level virtual memory
@@ -42,28 +49,151 @@
 	#define ALLOCATOR_PROFILE_FREE(ptr)
 #endif
 
+// use MAP_HUGETLB pages on linux for allocators with large_pages, falls back to transparent huge pages if that fails
+// (0) -> only use transparent huge pages (MADV_HUGEPAGE)  (1) -> try MAP_HUGETLB first
+#ifndef ALLOCATOR_HUGETLB
+	#define ALLOCATOR_HUGETLB 0
+#endif
+
 uint32_t get_os_page_size ();
 
 inline const int os_page_size = get_os_page_size();
 
-void* reserve_address_space (size_t size);
+// x86-64 large page size, allocators with large_pages commit in units of this
+inline constexpr size_t LARGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// granularity allocators commit and decommit in
+inline size_t get_commit_granularity (bool large_pages) {
+	return large_pages ? LARGE_PAGE_SIZE : (size_t)os_page_size;
+}
+inline size_t round_up_to_granularity (size_t size, size_t granularity) {
+	return (size + (granularity-1)) & ~(granularity-1);
+}
+
+// large_pages: base is LARGE_PAGE_SIZE aligned and size needs to be a multiple of it, on linux committed ranges can be backed by 2MB pages
+//  which reduces TLB misses for large arrays, but commits always cost a full 2MB
+void* reserve_address_space (size_t size, bool large_pages=false);
 void release_address_space (void* baseptr, size_t size);
 void commit_pages (void* ptr, size_t size);
 void decommit_pages (void* ptr, size_t size);
 
+// called by decommit_pages before the pages are dropped, used by MemorySnapshot to save pages it still needs
+inline void (*_decommit_hook) (void* ptr, size_t size) = nullptr;
+
+// file mapped into memory (MAP_SHARED), pages are read in lazily on first access and writes reach the file through the os page cache
+struct MappedFile {
+	char*		base = nullptr;
+	size_t		size = 0;
+	intptr_t	handle = -1; // fd or HANDLE
+	intptr_t	mapping = 0; // mapping HANDLE on windows
+};
+
+// open or create a file, grow it to size (sparse, so unused parts take no disk space) and map it read-write
+// existed is set to whether the file existed and was not empty, returns false on fail
+bool map_file (char const* filename, size_t size, MappedFile* file, bool* existed);
+void unmap_file (MappedFile& file);
+// write modified pages in [ptr, ptr+size) to disk and wait until that is done
+void flush_mapped_file (MappedFile& file, void* ptr, size_t size);
+
+// when allocators decommit memory that is no longer in use
+// without any retention an alloc/free pattern around a page boundary commits and decommits the same page every time
+struct RetentionPolicy {
+	// unused bytes that stay committed after the high-water mark, only trim() decommits these
+	size_t	retain_bytes = 0;
+	// memory up to the high-water mark of the last decay_sec seconds stays committed, so a steady grow/reset pattern (ie. per-frame arenas)
+	// never decommits, only once usage stays below the old peak for decay_sec it shrinks down to the peak of that window
+	// (on the next free/reset or decay() call after that), so decommits happen at most once per decay_sec
+	// 0 -> decommit down to the current usage as soon as usage drops
+	float	decay_sec = 0;
+};
+
+struct AllocatorStats {
+	size_t		committed; // bytes committed
+	size_t		used; // bytes up to the end of the last allocated item
+	size_t		retained; // committed bytes that are not used (committed - used)
+	size_t		high_water; // high-water mark that is currently retained
+	uint64_t	commit_calls; // number of commit_pages calls
+	uint64_t	decommit_calls; // number of decommit_pages calls
+};
+
+// decommit bookkeeping shared by VirtualPushAllocator, BlockAllocator and TlsfAllocator
+struct CommitRetention {
+	RetentionPolicy	policy;
+
+	size_t		high_water = 0; // retained peak usage, reaching it again restarts the window
+	size_t		window_high = 0; // peak usage since window_start that stayed below high_water
+	uint64_t	window_start = 0; // timestamp of when usage last reached high_water
+	uint64_t	commit_calls = 0;
+	uint64_t	decommit_calls = 0;
+
+	// called before usage drops
+	void update_high_water (size_t used) {
+		if (used >= high_water) {
+			high_water = used;
+			window_high = 0;
+			window_start = kiss::get_timestamp();
+		}
+		else {
+			window_high = std::max(window_high, used);
+		}
+	}
+
+	// returns the size the commited region should shrink to, or committed if it should stay
+	size_t shrink_to (size_t used, size_t committed, size_t page_size, bool trim=false) {
+		window_high = std::max(window_high, used);
+
+		size_t keep = used;
+		if (!trim && policy.decay_sec > 0) {
+			uint64_t now = kiss::get_timestamp();
+			if ((float)(now - window_start) < policy.decay_sec * (float)kiss::timestamp_freq) {
+				keep = std::max(high_water, used);
+			}
+			else {
+				// usage did not reach the high-water mark for a whole window, fall back to the peak of that window
+				keep = window_high;
+				high_water = window_high;
+				window_high = used;
+				window_start = now;
+			}
+		}
+
+		size_t target = round_up_to_granularity(keep + (trim ? 0 : policy.retain_bytes), page_size);
+		if (target >= committed)
+			return committed;
+
+		if (trim || policy.decay_sec <= 0) {
+			high_water = used;
+			window_high = 0;
+		}
+		decommit_calls++;
+		return target;
+	}
+
+	AllocatorStats stats (size_t used, size_t committed) const {
+		return { committed, used, committed - used, std::max(high_water, used), commit_calls, decommit_calls };
+	}
+};
+
 // like std::vector but with a reserved (contigous) max size so that no reallocation is ever needed
 class VirtualPushAllocator {
 	char* baseptr; // base address of reserved memory pages
 	char* allocptr; // [top] one past the last allocated item (next ptr to be allocated)
 	char* commitptr; // [baseptr, commitptr) is the commited memory region
 	char* reserveptr; // end of reserved memory, illegal to grow beyond this
+	size_t page_size; // commit granularity
+	CommitRetention retention;
 public:
 
-	inline VirtualPushAllocator (size_t max_size) {
-		baseptr = (char*)reserve_address_space(max_size);
+	// large_pages: commit in 2MB pages, see reserve_address_space
+	inline VirtualPushAllocator (size_t max_size, bool large_pages=false, RetentionPolicy policy={}) {
+		page_size = get_commit_granularity(large_pages);
+		max_size = round_up_to_granularity(max_size, page_size);
+
+		baseptr = (char*)reserve_address_space(max_size, large_pages);
 		allocptr = baseptr;
 		commitptr = baseptr;
 		reserveptr = baseptr + max_size;
+		retention.policy = policy;
 	}
 
 	inline ~VirtualPushAllocator () {
@@ -76,6 +206,13 @@ public:
 	inline size_t size () {
 		return allocptr - baseptr;
 	}
+	inline char* base () {
+		return baseptr;
+	}
+	// how many bytes are commited
+	inline size_t commit_size () {
+		return commitptr - baseptr;
+	}
 	
 	// Allocate [size] bytes from the top by 
 	inline char* push (size_t size, size_t align=1) {
@@ -85,21 +222,22 @@ public:
 		ptr = (char*)( ((uintptr_t)ptr + (align-1)) & ~(align-1) );
 
 		// allocate desired [size] bytes
-		ptr += size;
+		char* end = ptr + size;
 
 		// assert on overflow
-		assert(ptr <= reserveptr);
+		assert(end <= reserveptr);
 		
 	#if ALLOCATOR_NULLFAIL == 1
-		if (ptr > reserveptr)
+		if (end > reserveptr)
 			return nullptr;
 	#endif
 
-		if (ptr > commitptr) // at least one page to be committed
-			_grow(ptr);
+		if (end > commitptr) // at least one page to be committed
+			_grow(end);
 
-		DBG_MEMSET(allocptr, DBG_MEMSET_UNINITED, ptr - allocptr);
+		DBG_MEMSET(allocptr, DBG_MEMSET_UNINITED, end - allocptr);
 
+		allocptr = end;
 		return ptr;
 	}
 
@@ -109,10 +247,30 @@ public:
 
 		DBG_MEMSET(ptr, DBG_MEMSET_FREED, allocptr - ptr);
 
-		if (ptr <= commitptr - os_page_size) // at least 1 page to be decommitted
-			_shrink(ptr);
-
+		retention.update_high_water(allocptr - baseptr);
 		allocptr = ptr;
+
+		if (ptr <= commitptr - page_size) // at least 1 page could be decommitted
+			_shrink(false);
+	}
+
+	// decommit memory kept by the RetentionPolicy once it's decay_sec has passed, call this regularly (ie. once per frame)
+	// if reset() is not called often
+	void decay () {
+		if (allocptr <= commitptr - page_size)
+			_shrink(false);
+	}
+	// decommit all unused pages now, ignoring the RetentionPolicy
+	void trim () {
+		if (allocptr <= commitptr - page_size)
+			_shrink(true);
+	}
+
+	void set_retention_policy (RetentionPolicy policy) {
+		retention.policy = policy;
+	}
+	AllocatorStats stats () const {
+		return retention.stats(allocptr - baseptr, commitptr - baseptr);
 	}
 	
 	// called when at least one new page need to be commited
@@ -120,21 +278,21 @@ public:
 		assert(ptr > commitptr);
 		
 		// get new page aligned commit ptr
-		ptr = (char*)( ((uintptr_t)ptr + (os_page_size-1)) & ~(os_page_size-1) );
+		ptr = (char*)round_up_to_granularity((uintptr_t)ptr, page_size);
 
 		commit_pages(commitptr, ptr - commitptr);
 		commitptr = ptr;
+		retention.commit_calls++;
 	}
 
-	// called when at least one page need to be decommited
-	void _shrink (char* ptr) {
-		assert(ptr < commitptr);
-
-		// get new page aligned commit ptr
-		ptr = (char*)( ((uintptr_t)ptr + (os_page_size-1)) & ~(os_page_size-1) );
-
-		decommit_pages(ptr, commitptr - ptr);
-		commitptr = ptr;
+	// called when at least one page could be decommited
+	void _shrink (bool trim) {
+		size_t committed = commitptr - baseptr;
+		size_t target = retention.shrink_to(allocptr - baseptr, committed, page_size, trim);
+		if (target < committed) {
+			decommit_pages(baseptr + target, committed - target);
+			commitptr = baseptr + target;
+		}
 	}
 };
 
@@ -147,33 +305,79 @@ public:
 uint32_t _bsf_1 (uint64_t val);
 uint32_t _bsr_0 (uint64_t val);
 
+// index of first word in [start, count) that differs from [empty], returns count if none
+// compares 4 (AVX2) or 2 (SSE4.1) words at once if compiled with those enabled
+inline uint32_t _scan_forward_word (uint64_t const* words, uint32_t start, uint32_t count, uint64_t empty) {
+	uint32_t i = start;
+#if defined(__AVX2__)
+	__m256i e = _mm256_set1_epi64x((long long)empty);
+	for (; i + 4 <= count; i += 4) {
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((__m256i const*)&words[i]), e);
+		if (!_mm256_testz_si256(v, v)) break;
+	}
+#elif defined(__SSE4_1__)
+	__m128i e = _mm_set1_epi64x((long long)empty);
+	for (; i + 2 <= count; i += 2) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((__m128i const*)&words[i]), e);
+		if (!_mm_testz_si128(v, v)) break;
+	}
+#endif
+	for (; i < count; ++i) {
+		if (words[i] != empty)
+			return i;
+	}
+	return count;
+}
+// index of last word in [0, start] that differs from [empty], returns -1 if none
+inline int _scan_reverse_word (uint64_t const* words, uint32_t start, uint64_t empty) {
+	int i = (int)start;
+#if defined(__AVX2__)
+	__m256i e = _mm256_set1_epi64x((long long)empty);
+	for (; i >= 3; i -= 4) {
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((__m256i const*)&words[i-3]), e);
+		if (!_mm256_testz_si256(v, v)) break;
+	}
+#elif defined(__SSE4_1__)
+	__m128i e = _mm_set1_epi64x((long long)empty);
+	for (; i >= 1; i -= 2) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((__m128i const*)&words[i-1]), e);
+		if (!_mm_testz_si128(v, v)) break;
+	}
+#endif
+	for (; i >= 0; --i) {
+		if (words[i] != empty)
+			return i;
+	}
+	return -1;
+}
+
 // get index of first free (1) bit, starting at some point in the array
 // returns one past end of array if no free (1) bit found, because that one needs to be the next one allocated
 inline uint32_t scan_forward_free (uint64_t* bits, uint32_t count, uint32_t start) {
-	uint32_t i = start;
-	while (i < count) {
-		if (bits[i] != 0ull)
-			return (i << 6) + _bsf_1(bits[i]);
-		++i;
-	}
+	uint32_t i = _scan_forward_word(bits, start, count, 0ull);
+	if (i < count)
+		return (i << 6) + _bsf_1(bits[i]);
 	return count << 6;
 }
 
 // get index of last allocated (0) bit plus 1
 // returns 0 if no 0 bits are found, because all bits can be freed
 inline uint32_t scan_reverse_allocated (uint64_t* bits, uint32_t start) {
-	uint32_t i = start;
-	for (;;) {
-		if (bits[i] != ONES)
-			return (i << 6) + _bsr_0(bits[i]) + 1;
-		if (i == 0) break;
-		--i;
-	}
+	int i = _scan_reverse_word(bits, start, ONES);
+	if (i >= 0)
+		return ((uint32_t)i << 6) + _bsr_0(bits[i]) + 1;
 	return 0;
 }
 
+// bits plus two summary levels for both 'word has a free bit' and 'word has an allocated bit'
+// so alloc() and free() find the first free and last allocated slot by looking at 3 words instead of scanning, even when fragmented
+// (a top level word covers 262144 slots, so the top level scan is a single word up to that and still tiny at 10M+ slots)
 struct AllocatorBitset {
-	std::vector<uint64_t>	bits;
+	std::vector<uint64_t>	bits; // 1 = free slot
+	std::vector<uint64_t>	free_l1; // bit i: bits[i] != 0
+	std::vector<uint64_t>	free_l2; // bit i: free_l1[i] != 0
+	std::vector<uint64_t>	alloc_l1; // bit i: bits[i] != ONES
+	std::vector<uint64_t>	alloc_l2; // bit i: alloc_l1[i] != 0
 	uint32_t				first_free = 0; // index of first free (1) bit in bits, to speed up alloc
 	uint32_t				alloc_end = 0; // index of the free region of 1 bits starting after the last allocated (0) bit, to speed up paging for users
 	
@@ -194,9 +398,10 @@ struct AllocatorBitset {
 		// clear bit
 		assert(bits[idx >> 6] & (1ull << (idx & 63)));
 		bits[idx >> 6] &= ~(1ull << (idx & 63));
+		_update_summary(idx >> 6);
 
-		// update first_free by scanning to right for next free bit, skips bits before current first_free
-		first_free = scan_forward_free(bits.data(), (uint32_t)bits.size(), first_free >> 6);
+		// update first_free via the summary levels
+		first_free = _find_first_free();
 
 		// update alloc_end
 		alloc_end = std::max(idx+1, alloc_end);
@@ -206,6 +411,26 @@ struct AllocatorBitset {
 
 	void _grow () {
 		bits.push_back(ONES);
+		_resize_summary();
+	}
+
+	// restore from previously stored bits
+	void load (uint64_t const* words, uint32_t count) {
+		bits.assign(words, words + count);
+		free_l1.clear(); free_l2.clear();
+		alloc_l1.clear(); alloc_l2.clear();
+		_resize_summary();
+		for (uint32_t i=0; i<count; ++i)
+			_update_summary(i);
+
+		first_free = _find_first_free();
+		alloc_end = _find_alloc_end();
+
+		uint32_t needed_bits = (alloc_end + 63) >> 6;
+		if (needed_bits < (uint32_t)bits.size()) {
+			bits.resize(needed_bits);
+			_resize_summary();
+		}
 	}
 
 	// free an allocated (0) bit by setting it to 1
@@ -215,6 +440,7 @@ struct AllocatorBitset {
 
 		// set bit in freeset to 1
 		bits[idx >> 6] |= 1ull << (idx & 63);
+		_update_summary(idx >> 6);
 
 		// only rescan for alloc_end (and potentially shrink bit array) if the last allocated bit was freed
 		if (idx >= alloc_end-1)
@@ -226,13 +452,73 @@ struct AllocatorBitset {
 
 	void _shrink (uint32_t idx) {
 		assert(idx == alloc_end-1);
-		// update alloc_end by scanning to left for next allocated bit, skips bits after current first_free
-		alloc_end = scan_reverse_allocated(bits.data(), (alloc_end-1) >> 6);
+		// update alloc_end via the summary levels
+		alloc_end = _find_alloc_end();
 
 		// shrink bits if there are contiguous zero ints at the end
-		uint32_t needed_bits = ((alloc_end-1) >> 6) + 1; 
-		if (needed_bits < (uint32_t)bits.size())
+		uint32_t needed_bits = (alloc_end + 63) >> 6;
+		if (needed_bits < (uint32_t)bits.size()) {
 			bits.resize(needed_bits);
+			_resize_summary();
+		}
+	}
+
+	static void _set_bit (std::vector<uint64_t>& level, uint32_t i, bool val) {
+		if (val) level[i >> 6] |=   1ull << (i & 63);
+		else     level[i >> 6] &= ~(1ull << (i & 63));
+	}
+
+	void _update_summary (uint32_t word) {
+		uint32_t l1 = word >> 6;
+		_set_bit(free_l1, word, bits[word] != 0ull);
+		_set_bit(free_l2, l1, free_l1[l1] != 0ull);
+		_set_bit(alloc_l1, word, bits[word] != ONES);
+		_set_bit(alloc_l2, l1, alloc_l1[l1] != 0ull);
+	}
+
+	// fit summary levels to bits.size(), new words are only ever ONES and removed words only ever ONES
+	void _resize_summary () {
+		uint32_t words = (uint32_t)bits.size();
+		uint32_t l1_words = (words + 63) >> 6;
+		uint32_t l2_words = (l1_words + 63) >> 6;
+
+		free_l1.resize(l1_words, 0);
+		alloc_l1.resize(l1_words, 0);
+		free_l2.resize(l2_words, 0);
+		alloc_l2.resize(l2_words, 0);
+
+		if (words == 0) return;
+
+		// words past the end must not show up as free, the last word may have been appended or removed
+		uint32_t last = words - 1;
+		if (words & 63)
+			free_l1[last >> 6] &= ~(ONES << (words & 63));
+		if (l1_words & 63)
+			free_l2[(l1_words-1) >> 6] &= ~(ONES << (l1_words & 63));
+		_update_summary(last);
+	}
+
+	uint32_t _find_first_free () {
+		uint32_t count = (uint32_t)free_l2.size();
+		uint32_t i2 = _scan_forward_word(free_l2.data(), 0, count, 0ull);
+		if (i2 == count)
+			return (uint32_t)bits.size() << 6;
+
+		uint32_t i1 = (i2 << 6) + _bsf_1(free_l2[i2]);
+		uint32_t i0 = (i1 << 6) + _bsf_1(free_l1[i1]);
+		return (i0 << 6) + _bsf_1(bits[i0]);
+	}
+
+	uint32_t _find_alloc_end () {
+		if (alloc_l2.empty())
+			return 0;
+		int i2 = _scan_reverse_word(alloc_l2.data(), (uint32_t)alloc_l2.size()-1, 0ull);
+		if (i2 < 0)
+			return 0;
+
+		uint32_t i1 = ((uint32_t)i2 << 6) + _bsr_0(~alloc_l2[i2]);
+		uint32_t i0 = (i1 << 6) + _bsr_0(~alloc_l1[i1]);
+		return (i0 << 6) + _bsr_0(bits[i0]) + 1;
 	}
 };
 
@@ -242,14 +528,117 @@ struct BlockAllocator {
 	uint32_t	count = 0;
 	uint32_t	max_count;
 	char*		commit_end;
+	size_t		reserve_size;
+	size_t		page_size; // commit granularity
 	AllocatorBitset	slots;
-
-	BlockAllocator (uint32_t max_count): max_count{max_count} {
-		arr = (T*)reserve_address_space(max_count * sizeof(T));
+	CommitRetention	retention;
+	MappedFile		file; // only for file backed allocators
+	MemTag			tag = MEMTAG_OTHER; // see set_tag
+
+	// stored at the start of the file of file backed allocators, followed by the bitset and the (page aligned) slots
+	struct FileHeader {
+		char		magic[8];
+		uint32_t	header_version; // layout of this header
+		uint32_t	version; // user version, bump when the layout of T changes
+		uint32_t	elem_size;
+		uint32_t	elem_align;
+		uint32_t	max_count;
+		uint32_t	count;
+		uint32_t	bitset_words;
+		uint32_t	_pad;
+	};
+	static constexpr char FILE_MAGIC[8] = "KISSBLK";
+	static constexpr uint32_t FILE_HEADER_VERSION = 1;
+
+	// large_pages: commit in 2MB pages, see reserve_address_space
+	BlockAllocator (uint32_t max_count, bool large_pages=false, RetentionPolicy policy={}): max_count{max_count} {
+		retention.policy = policy;
+		page_size = get_commit_granularity(large_pages);
+		reserve_size = round_up_to_granularity((size_t)max_count * sizeof(T), page_size);
+
+		arr = (T*)reserve_address_space(reserve_size, large_pages);
 		commit_end = (char*)arr;
 	}
+
+	// File backed allocator: the slots are a memory mapped file, so they persist across runs without being serialized
+	// loading only maps the file, slots are paged in on first access, so startup is O(touched pages) instead of O(file size)
+	// T has to be trivially copyable and must not contain pointers (use indices), since the file can be mapped at a different address
+	// version is stored in the file, bump it whenever the layout of T changes, opening a file with a different version, sizeof(T) or max_count throws
+	// allocated slots are only written to disk by the os eventually (and on destruction), call checkpoint() for a consistent state on disk
+	// memory is never decommitted, freed slots keep their contents in the file
+	BlockAllocator (char const* filename, uint32_t max_count, uint32_t version): max_count{max_count} {
+		static_assert(std::is_trivially_copyable_v<T>, "BlockAllocator: file backed T needs to be trivially copyable");
+
+		page_size = (size_t)os_page_size;
+		size_t data_offset = _file_data_offset();
+		reserve_size = round_up_to_granularity((size_t)max_count * sizeof(T), page_size);
+
+		bool existed;
+		if (!map_file(filename, data_offset + reserve_size, &file, &existed))
+			throw std::runtime_error("BlockAllocator: could not map file!");
+
+		arr = (T*)(file.base + data_offset);
+		commit_end = (char*)arr + reserve_size; // file is mapped completely, nothing to commit
+
+		auto* header = (FileHeader*)file.base;
+		if (!existed) {
+			memcpy(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+			header->header_version = FILE_HEADER_VERSION;
+			header->version = version;
+			header->elem_size = sizeof(T);
+			header->elem_align = alignof(T);
+			header->max_count = max_count;
+			_write_header();
+		}
+		else {
+			if (memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header->header_version != FILE_HEADER_VERSION ||
+					header->version != version || header->elem_size != sizeof(T) || header->elem_align != alignof(T) ||
+					header->max_count != max_count ||
+					// only _file_data_offset() - sizeof(FileHeader) bytes are reserved for the bitset, don't read past them on a corrupt header
+					header->bitset_words > (uint32_t)(((size_t)max_count + 63) / 64) || header->count > max_count) {
+				unmap_file(file);
+				throw std::runtime_error("BlockAllocator: file layout version mismatch or corrupt header!");
+			}
+
+			slots.load(_file_bitset(), header->bitset_words);
+			count = header->count;
+			MEMTRACK_ALLOC_N(tag, (size_t)count * sizeof(T), count);
+		}
+	}
+
 	~BlockAllocator () {
-		release_address_space(arr, max_count * sizeof(T));
+		MEMTRACK_FREE_N(tag, (size_t)count * sizeof(T), count);
+		if (file.base) {
+			_write_header();
+			unmap_file(file);
+		}
+		else {
+			release_address_space(arr, reserve_size);
+		}
+	}
+
+	// file backed only: store the allocation state in the file and write all modified pages to disk
+	// the file is consistent as of this call afterwards
+	void checkpoint () {
+		assert(file.base);
+		// slots first, so the bitset on disk never refers to slot data that did not reach the disk
+		flush_mapped_file(file, arr, reserve_size);
+		_write_header();
+		flush_mapped_file(file, file.base, (char*)arr - file.base);
+	}
+
+	size_t _file_data_offset () const {
+		size_t size = sizeof(FileHeader) + (size_t)((max_count + 63) / 64) * sizeof(uint64_t);
+		return round_up_to_granularity(size, page_size);
+	}
+	uint64_t* _file_bitset () {
+		return (uint64_t*)(file.base + sizeof(FileHeader));
+	}
+	void _write_header () {
+		auto* header = (FileHeader*)file.base;
+		header->count = count;
+		header->bitset_words = (uint32_t)slots.bits.size();
+		memcpy(_file_bitset(), slots.bits.data(), slots.bits.size() * sizeof(uint64_t));
 	}
 
 	T& operator[] (uint32_t idx) {
@@ -271,14 +660,16 @@ struct BlockAllocator {
 		char* new_end = (char*)&arr[idx +1];
 		if (new_end > commit_end) { // commit pages when needed
 			
-			char* new_commit_ptr = (char*)(((uintptr_t)new_end + os_page_size-1) & ~(os_page_size-1)); // round up needed commit_end
+			char* new_commit_ptr = (char*)round_up_to_granularity((uintptr_t)new_end, page_size); // round up needed commit_end
 			commit_pages(commit_end, new_commit_ptr - commit_end);
 			commit_end = new_commit_ptr;
+			retention.commit_calls++;
 
 			// Memory is zero inited
 		}
 
 		ALLOCATOR_PROFILE_ALLOC(&arr[idx], sizeof(T))
+		MEMTRACK_ALLOC(tag, sizeof(T));
 		return idx;
 	}
 
@@ -287,20 +678,60 @@ struct BlockAllocator {
 
 		assert(slots.is_allocated(idx));
 
+		retention.update_high_water(used_size());
+
 		slots.free(idx);
 		count--;
 
 		char* new_end = (char*)&arr[slots.alloc_end];
-		if (new_end <= commit_end - os_page_size) { // free pages when needed
+		if (new_end <= commit_end - page_size) // free pages when needed
+			_shrink(false);
 
-			char* new_commit_ptr = (char*)(((uintptr_t)new_end + os_page_size-1) & ~(os_page_size-1)); // round up needed commit_end
-			decommit_pages(new_commit_ptr, commit_end - new_commit_ptr);
-			commit_end = new_commit_ptr;
+		ALLOCATOR_PROFILE_FREE(&arr[idx])
+		MEMTRACK_FREE(tag, sizeof(T));
+	}
+
+	// category the slots count towards in g_mem_tracker, already allocated slots move over to the new tag
+	void set_tag (MemTag new_tag) {
+		MEMTRACK_FREE_N(tag, (size_t)count * sizeof(T), count);
+		MEMTRACK_ALLOC_N(new_tag, (size_t)count * sizeof(T), count);
+		tag = new_tag;
+	}
+
+	// decommit memory kept by the RetentionPolicy once it's decay_sec has passed, call this regularly (ie. once per frame)
+	// if free() is not called often
+	void decay () {
+		if (used_size() + page_size <= commit_size())
+			_shrink(false);
+	}
+	// decommit all unused pages now, ignoring the RetentionPolicy
+	void trim () {
+		if (used_size() + page_size <= commit_size())
+			_shrink(true);
+	}
+
+	void _shrink (bool trim) {
+		if (file.base) return; // file backed memory is never decommitted
+
+		size_t committed = commit_size();
+		size_t target = retention.shrink_to(used_size(), committed, page_size, trim);
+		if (target < committed) {
+			decommit_pages((char*)arr + target, committed - target);
+			commit_end = (char*)arr + target;
 		}
+	}
 
-		ALLOCATOR_PROFILE_FREE(&arr[idx])
+	void set_retention_policy (RetentionPolicy policy) {
+		retention.policy = policy;
+	}
+	AllocatorStats stats () const {
+		return retention.stats(used_size(), commit_size());
 	}
 
+	// bytes up to the end of the last allocated slot
+	size_t used_size () const {
+		return (size_t)slots.alloc_end * sizeof(T);
+	}
 	// how many bytes are commited
 	size_t commit_size () const {
 		return commit_end - (char*)arr;
@@ -0,0 +1,168 @@
+#pragma once
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <cstddef>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+#include "allocator.hpp"
+
+// Linear allocators for transient memory, allocations are not freed individually, but all at once by resetting to a marker
+// instead of going through malloc for temporary arrays of a function, a job or a frame
+
+// VirtualPushAllocator with peak usage tracking
+// keeps memory up to the high-water mark of the last few seconds (plus 1MB) committed after resets
+// so that an arena that is filled and reset every frame does not commit and decommit the same pages every frame
+class Arena {
+	NO_MOVE_COPY_CLASS(Arena)
+
+	VirtualPushAllocator mem;
+
+public:
+	size_t peak = 0; // largest size() since last reset_peak()
+
+	Arena (size_t max_size, RetentionPolicy policy = { 1*MB, 5.0f }): mem{max_size, false, policy} {}
+
+	void* alloc (size_t size, size_t align=alignof(max_align_t)) {
+		void* ptr = mem.push(size, align);
+		if (!ptr) throw std::bad_alloc();
+		return ptr;
+	}
+	template <typename T>
+	T* alloc_array (size_t count) {
+		return (T*)alloc(count * sizeof(T), alignof(T));
+	}
+
+	// free everything allocated after marker was taken
+	char* marker () {
+		return mem.top();
+	}
+	void reset (char* marker) {
+		peak = std::max(peak, mem.size());
+		mem.reset(marker);
+	}
+	// free everything
+	void clear () {
+		reset(mem.top() - mem.size());
+	}
+
+	// free an allocation if it's the last one, returns false otherwise (memory is only freed by reset then)
+	bool try_free_top (void* ptr, size_t size) {
+		if ((char*)ptr + size != mem.top())
+			return false;
+		mem.reset((char*)ptr);
+		return true;
+	}
+
+	size_t size () {
+		return mem.size();
+	}
+	size_t reset_peak () {
+		size_t p = std::max(peak, mem.size());
+		peak = 0;
+		return p;
+	}
+
+	VirtualPushAllocator& memory () {
+		return mem;
+	}
+};
+
+// resets the arena to where it was at construction when going out of scope
+/* pattern:
+	void job () {
+		auto& scratch = get_scratch_arena();
+		ArenaScope scope(scratch);
+
+		arena_vector<int> tmp(scratch);
+		...
+	} // tmp memory freed here
+*/
+class ArenaScope {
+	NO_MOVE_COPY_CLASS(ArenaScope)
+
+	Arena&	arena;
+	char*	mark;
+public:
+	ArenaScope (Arena& arena): arena{arena}, mark{arena.marker()} {}
+	~ArenaScope () {
+		arena.reset(mark);
+	}
+};
+
+// std allocator adaptor for opting containers into an arena
+// deallocate only frees if the memory is at the top of the arena (ie. the last vector pushed to), everything else is freed by the arena reset
+// so containers must not outlive the ArenaScope or frame they were created in
+template <typename T>
+struct ArenaAllocator {
+	typedef T value_type;
+
+	Arena* arena;
+
+	ArenaAllocator (Arena& arena): arena{&arena} {}
+	template <typename U>
+	ArenaAllocator (ArenaAllocator<U> const& r): arena{r.arena} {}
+
+	T* allocate (size_t n) {
+		return arena->alloc_array<T>(n);
+	}
+	void deallocate (T* ptr, size_t n) {
+		arena->try_free_top(ptr, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator== (ArenaAllocator<U> const& r) const { return arena == r.arena; }
+	template <typename U>
+	bool operator!= (ArenaAllocator<U> const& r) const { return arena != r.arena; }
+};
+
+template <typename T>
+using arena_vector = std::vector<T, ArenaAllocator<T>>;
+
+// per-thread scratch arena for jobs and temporary arrays, use with ArenaScope
+// reserves address space on first use per thread, memory is only committed as needed
+inline Arena& get_scratch_arena () {
+	static thread_local Arena arena (256*MB);
+	return arena;
+}
+
+// Double buffered arena for memory that only needs to live for the current frame
+// memory allocated in frame N stays valid during frame N+1 (so the render thread of a pipelined engine can still read it)
+// and is freed when frame N+2 begins
+// each arena keeps it's recent per-frame peak committed (see RetentionPolicy), so steady frames never commit or decommit
+class FrameArena {
+	NO_MOVE_COPY_CLASS(FrameArena)
+
+	Arena	arenas[2];
+	int		cur = 0;
+
+public:
+	size_t	last_frame_peak = 0; // peak usage of the last completed frame
+	size_t	max_frame_peak = 0; // highest last_frame_peak so far
+
+	FrameArena (size_t max_size_per_frame, RetentionPolicy policy = { 1*MB, 5.0f }):
+		arenas{ Arena(max_size_per_frame, policy), Arena(max_size_per_frame, policy) } {}
+
+	Arena& current () {
+		return arenas[cur];
+	}
+
+	void* alloc (size_t size, size_t align=alignof(max_align_t)) {
+		return current().alloc(size, align);
+	}
+	template <typename T>
+	T* alloc_array (size_t count) {
+		return current().alloc_array<T>(count);
+	}
+
+	// switch to the other arena and free what was allocated in it 2 frames ago
+	void begin_frame () {
+		last_frame_peak = current().reset_peak();
+		max_frame_peak = std::max(max_frame_peak, last_frame_peak);
+
+		cur ^= 1;
+		current().clear();
+		current().reset_peak();
+	}
+};
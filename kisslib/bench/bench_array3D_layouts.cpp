@@ -0,0 +1,118 @@
+// Meshing-style benchmark for the array3D layouts (FlatLayout vs BrickedLayout vs MortonLayout)
+// mesh: count the visible faces of a 256^3 terrain (6-neighbour check per solid voxel) in storage order via for_each_neighbours
+//       plus the xyz get() loop the voxel code used before as a baseline
+// local: visit random 8^3 regions and check the 6 neighbours of every voxel via neighbours(), like remeshing single chunks after edits
+// not part of any build, needs kissmath, so compile from the repo root with the same compiler and include paths as the engine:
+//  clang++ -std=c++20 -O2 -DNDEBUG -I. -I<deps> kisslib/bench/bench_array3D_layouts.cpp kisslib/timer.cpp
+//  (msvc: add the same files to an empty console project)
+#include "kisslib/kissmath.hpp"
+#include "kisslib/containers.hpp"
+#include "kisslib/timer.hpp"
+#include <cstdio>
+using namespace kissmath;
+
+static constexpr int SIZE = 256;
+static constexpr int REPS = 5;
+static constexpr int REGIONS = 20000;
+static constexpr int REGION = 8;
+
+template <typename LAYOUT>
+static void gen_terrain (array3D<uint8_t, LAYOUT>& voxels) {
+	voxels.for_each([&] (int3 pos, uint8_t& val) {
+		float height = (float)SIZE * 0.5f + sinf((float)pos.x * 0.05f) * 20.0f + cosf((float)pos.z * 0.07f) * 20.0f;
+		// some caves so that the inside is not all solid
+		bool cave = sinf((float)pos.x * 0.3f) * sinf((float)pos.y * 0.3f) * sinf((float)pos.z * 0.3f) > 0.6f;
+		val = (float)pos.y < height && !cave ? 1 : 0;
+	});
+}
+
+template <typename LAYOUT>
+static void bench (char const* name) {
+	int3 size = SIZE;
+	array3D<uint8_t, LAYOUT> voxels (size);
+	gen_terrain(voxels);
+
+	// full volume in storage order
+	size_t faces = 0;
+	float best = 1e30f;
+	for (int rep=0; rep<REPS; ++rep) {
+		faces = 0;
+		auto timer = kiss::Timer::start();
+
+		voxels.for_each_neighbours([&] (int3 pos, uint8_t& val, auto const& n) {
+			if (!val) return;
+			n.for_each_face([&] (int face, uint8_t* neighbour) {
+				if (!neighbour || !*neighbour) faces++;
+			});
+		});
+
+		best = min(best, timer.end());
+	}
+
+	// xyz loop with get(), what code that is not aware of the layout does
+	float best_xyz = 1e30f;
+	for (int rep=0; rep<REPS; ++rep) {
+		size_t xyz_faces = 0;
+		auto timer = kiss::Timer::start();
+
+		for (int z=0; z<SIZE; ++z)
+		for (int y=0; y<SIZE; ++y)
+		for (int x=0; x<SIZE; ++x) {
+			if (!voxels.get(x,y,z)) continue;
+			if (x == 0      || !voxels.get(x-1,y,z)) xyz_faces++;
+			if (x == SIZE-1 || !voxels.get(x+1,y,z)) xyz_faces++;
+			if (y == 0      || !voxels.get(x,y-1,z)) xyz_faces++;
+			if (y == SIZE-1 || !voxels.get(x,y+1,z)) xyz_faces++;
+			if (z == 0      || !voxels.get(x,y,z-1)) xyz_faces++;
+			if (z == SIZE-1 || !voxels.get(x,y,z+1)) xyz_faces++;
+		}
+
+		best_xyz = min(best_xyz, timer.end());
+		if (xyz_faces != faces) {
+			printf("%s: face count mismatch %zu != %zu\n", name, xyz_faces, faces);
+			return;
+		}
+	}
+
+	// random local regions
+	uint64_t rand_state = 0x9E3779B97F4A7C15ull;
+	auto next_rand = [&] () {
+		rand_state ^= rand_state << 13;
+		rand_state ^= rand_state >> 7;
+		rand_state ^= rand_state << 17;
+		return (int)(rand_state >> 40);
+	};
+
+	size_t local_faces = 0;
+	auto timer = kiss::Timer::start();
+	for (int r=0; r<REGIONS; ++r) {
+		int regions = SIZE / REGION;
+		int3 base = int3(next_rand() % regions, next_rand() % regions, next_rand() % regions) * REGION;
+
+		for (int z=0; z<REGION; ++z)
+		for (int y=0; y<REGION; ++y)
+		for (int x=0; x<REGION; ++x) {
+			int3 pos = base + int3(x,y,z);
+			if (!voxels.get(pos)) continue;
+			auto n = voxels.neighbours(pos);
+			for (int face=0; face<6; ++face) {
+				if (!n[face] || !*n[face]) local_faces++;
+			}
+		}
+	}
+	float local = timer.end();
+
+	printf("  %-18s  %14.2f  %14.2f  %14.2f   (%zu faces, %zu local)\n", name,
+		best * 1000, best_xyz * 1000, local * 1000, faces, local_faces);
+}
+
+int main () {
+	printf("%d^3 voxels, best of %d, local: %d random %d^3 regions\n\n", SIZE, REPS, REGIONS, REGION);
+	printf("  %-18s  %14s  %14s  %14s\n", "layout", "mesh [ms]", "xyz get [ms]", "local [ms]");
+
+	bench<FlatLayout>("flat");
+	bench<BrickedLayout<4>>("bricked 4^3");
+	bench<BrickedLayout<8>>("bricked 8^3");
+	bench<MortonLayout>("morton");
+	return 0;
+}
@@ -0,0 +1,195 @@
+// Benchmark for AllocatorBitset's summary levels (free_l1/l2, alloc_l1/l2) against the linear word scan it used before, on large fragmented allocators
+// random: N slots at some occupancy, every op frees a random allocated slot and allocates one (like entities or chunks coming and going)
+// churn:  the lower part of the slots is long-lived, the churn happens inside it, so the linear first_free scan has to cross it on every alloc
+// alloc_end: free the last allocated slot of a fragmented set, so alloc_end has to be searched backwards (_find_alloc_end vs scan_reverse_allocated)
+// the linear baseline is the old AllocatorBitset (first_free / alloc_end updated with _scan_forward_word / _scan_reverse_word over bits)
+// BlockAllocator is the summary level bitset plus committing pages, as the allocator is actually used
+// not part of any build, compile from the repo root with the same include paths as the engine (for tracy/Tracy.hpp):
+//  g++ -std=c++20 -O2 -DNDEBUG -march=native -I. -I<deps> kisslib/bench/bench_block_allocator_fragmented.cpp kisslib/allocator.cpp kisslib/timer.cpp -lpthread
+//  (msvc: add the same files to an empty console project)
+#include "kisslib/allocator.hpp"
+#include "kisslib/timer.hpp"
+#include <vector>
+#include <cstdio>
+
+// AllocatorBitset before the summary levels were added
+struct LinearBitset {
+	std::vector<uint64_t>	bits;
+	uint32_t				first_free = 0;
+	uint32_t				alloc_end = 0;
+
+	uint32_t alloc () {
+		uint32_t idx = first_free;
+		if (idx == ((uint32_t)bits.size() << 6))
+			bits.push_back(ONES);
+
+		bits[idx >> 6] &= ~(1ull << (idx & 63));
+		first_free = scan_forward_free(bits.data(), (uint32_t)bits.size(), first_free >> 6);
+		alloc_end = std::max(idx+1, alloc_end);
+		return idx;
+	}
+	void free (uint32_t idx) {
+		bits[idx >> 6] |= 1ull << (idx & 63);
+		if (idx >= alloc_end-1) {
+			alloc_end = scan_reverse_allocated(bits.data(), (alloc_end-1) >> 6);
+			uint32_t needed_bits = (alloc_end + 63) >> 6;
+			if (needed_bits < (uint32_t)bits.size())
+				bits.resize(needed_bits);
+		}
+		first_free = std::min(first_free, idx);
+	}
+};
+
+struct Slot {
+	uint64_t data[2];
+};
+// BlockAllocator with the interface of the bitsets
+struct BlockAllocatorBench {
+	BlockAllocator<Slot> alloc_ { 1u << 26 };
+	uint32_t alloc () {
+		uint32_t idx = alloc_.alloc();
+		alloc_[idx].data[0] = idx;
+		return idx;
+	}
+	void free (uint32_t idx) { alloc_.free(idx); }
+};
+
+struct Rng {
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	uint32_t next () {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (uint32_t)(state >> 32);
+	}
+};
+
+static constexpr int OPS = 1 << 18;
+
+// returns ns per free+alloc pair
+// live: allocated slot indices, churn_range: only slots below this are freed
+template <typename BITSET>
+static double run_ops (BITSET& b, std::vector<uint32_t>& live, uint32_t churn_range) {
+	Rng rng;
+	// indices into live of slots inside churn_range
+	std::vector<uint32_t> churn;
+	for (uint32_t i=0; i<(uint32_t)live.size(); ++i)
+		if (live[i] < churn_range) churn.push_back(i);
+
+	auto timer = kiss::Timer::start();
+	for (int op=0; op<OPS; ++op) {
+		uint32_t& slot = live[churn[rng.next() % churn.size()]];
+		b.free(slot);
+		slot = b.alloc();
+	}
+	return (double)timer.end() / OPS * 1e9;
+}
+
+// fill slots and free random ones until occupancy is reached, returns the live slot indices
+template <typename BITSET>
+static std::vector<uint32_t> fragment (BITSET& b, uint32_t slots, float occupancy) {
+	std::vector<uint32_t> live (slots);
+	for (uint32_t i=0; i<slots; ++i)
+		live[i] = b.alloc();
+
+	Rng rng;
+	uint32_t target = (uint32_t)((double)slots * occupancy);
+	while ((uint32_t)live.size() > target) {
+		uint32_t i = rng.next() % (uint32_t)live.size();
+		b.free(live[i]);
+		live[i] = live.back();
+		live.pop_back();
+	}
+	return live;
+}
+
+template <typename BITSET>
+static double bench_random (uint32_t slots, float occupancy) {
+	BITSET b;
+	auto live = fragment(b, slots, occupancy);
+	return run_ops(b, live, slots);
+}
+
+// all slots are allocated, then ops only free and re-allocate inside the lower half
+// frees there set first_free low, the alloc fills it and the next free slot is only found at the end of the allocated range
+template <typename BITSET>
+static double bench_churn (uint32_t slots) {
+	BITSET b;
+	auto live = fragment(b, slots, 1.0f);
+	return run_ops(b, live, slots / 2);
+}
+
+// time to find alloc_end after the last allocated slot was freed, with the previous allocated slot gap_slots lower
+// everything below that is fragmented at 50% occupancy
+static void bench_alloc_end (uint32_t gap_slots, double* summary_ns, double* linear_ns) {
+	uint32_t slots = 1u << 20;
+	AllocatorBitset b;
+	for (uint32_t i=0; i<slots + gap_slots; ++i)
+		b.alloc();
+	Rng rng;
+	for (uint32_t i=0; i<slots; ++i)
+		if (rng.next() & 1) b.free(i);
+	// free the gap, the very last slot stays allocated, so the bitset does not shrink
+	uint32_t last = slots + gap_slots - 1;
+	for (uint32_t i=slots; i<last; ++i)
+		b.free(i);
+
+	// then free the last slot like free() would, but without the search that shrinks the bitset, so that we can repeat it
+	b.bits[last >> 6] |= 1ull << (last & 63);
+	b._update_summary(last >> 6);
+
+	constexpr int REPS = 1 << 12;
+	uint32_t last_word = (uint32_t)b.bits.size() - 1;
+	volatile uint32_t sink = 0;
+
+	auto timer = kiss::Timer::start();
+	for (int i=0; i<REPS; ++i)
+		sink = b._find_alloc_end();
+	*summary_ns = (double)timer.end() / REPS * 1e9;
+
+	timer = kiss::Timer::start();
+	for (int i=0; i<REPS; ++i)
+		sink = scan_reverse_allocated(b.bits.data(), last_word);
+	*linear_ns = (double)timer.end() / REPS * 1e9;
+	(void)sink;
+}
+
+int main () {
+	printf("%d free+alloc pairs per run, best of 3\n\n", OPS);
+
+	printf("random ops at occupancy\n");
+	printf("  slots        occupancy   summary [ns/op]   linear [ns/op]   BlockAllocator [ns/op]\n");
+	for (uint32_t slots : { 1u << 20, 1u << 24 }) {
+		for (float occupancy : { 0.5f, 0.9f, 0.99f }) {
+			double summary = 1e30, linear = 1e30, block = 1e30;
+			for (int rep=0; rep<3; ++rep) {
+				summary = std::min(summary, bench_random<AllocatorBitset>(slots, occupancy));
+				linear  = std::min(linear,  bench_random<LinearBitset>(slots, occupancy));
+				block   = std::min(block,   bench_random<BlockAllocatorBench>(slots, occupancy));
+			}
+			printf("  %9u   %9.0f%%   %15.1f   %14.1f   %22.1f\n", slots, occupancy * 100, summary, linear, block);
+		}
+	}
+
+	printf("\nchurn in the lower half of fully allocated slots\n");
+	printf("  slots        summary [ns/op]   linear [ns/op]   BlockAllocator [ns/op]\n");
+	// the linear scan is O(slots) per alloc here, so keep this smaller than the random case
+	for (uint32_t slots : { 1u << 14, 1u << 17, 1u << 20 }) {
+		double summary = 1e30, linear = 1e30, block = 1e30;
+		for (int rep=0; rep<3; ++rep) {
+			summary = std::min(summary, bench_churn<AllocatorBitset>(slots));
+			linear  = std::min(linear,  bench_churn<LinearBitset>(slots));
+			block   = std::min(block,   bench_churn<BlockAllocatorBench>(slots));
+		}
+		printf("  %9u   %15.1f   %14.1f   %22.1f\n", slots, summary, linear, block);
+	}
+
+	printf("\nalloc_end search after freeing the last slot, with gap free slots before it (1M fragmented slots below the gap)\n");
+	printf("  gap [slots]   _find_alloc_end [ns]   scan_reverse_allocated [ns]\n");
+	for (uint32_t gap : { 64u, 1u << 12, 1u << 16, 1u << 20, 1u << 24 }) {
+		double summary, linear;
+		bench_alloc_end(gap, &summary, &linear);
+		printf("  %11u   %20.1f   %27.1f\n", gap, summary, linear);
+	}
+	return 0;
+}
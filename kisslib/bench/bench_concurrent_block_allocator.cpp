@@ -0,0 +1,83 @@
+// Scaling benchmark for ConcurrentBlockAllocator on 1-32 threads, against a BlockAllocator behind a mutex
+// every thread repeatedly allocates a batch of slots, writes them and frees them again (like worker threads creating and dropping chunk data)
+// not part of any build, compile from the repo root with the same include paths as the engine (for tracy/Tracy.hpp):
+//  g++ -std=c++20 -O2 -I. -I<deps> kisslib/bench/bench_concurrent_block_allocator.cpp kisslib/allocator.cpp kisslib/timer.cpp -lpthread
+//  (msvc: add the same files to an empty console project)
+#include "kisslib/concurrent_block_allocator.hpp"
+#include "kisslib/timer.hpp"
+#include <thread>
+#include <vector>
+#include <cstdio>
+
+struct Slot {
+	uint64_t data[8]; // one cache line
+};
+
+static constexpr uint32_t MAX_SLOTS = 1u << 22;
+static constexpr int BATCH = 2000;
+static constexpr int ROUNDS = 50;
+
+struct LockedBlockAllocator {
+	BlockAllocator<Slot>	alloc { MAX_SLOTS };
+	std::mutex				mutex;
+};
+
+// returns alloc+free pairs per second over all threads
+template <typename ALLOC, typename FREE, typename GET>
+static double run (int threads, ALLOC alloc, FREE free, GET get) {
+	auto timer = kiss::Timer::start();
+
+	std::vector<std::thread> workers;
+	for (int t=0; t<threads; ++t) {
+		workers.emplace_back([=] () {
+			std::vector<uint32_t> slots;
+			slots.reserve(BATCH);
+
+			for (int r=0; r<ROUNDS; ++r) {
+				for (int i=0; i<BATCH; ++i) {
+					uint32_t idx = alloc();
+					get(idx).data[0] = idx;
+					slots.push_back(idx);
+				}
+				for (uint32_t idx : slots)
+					free(idx);
+				slots.clear();
+			}
+		});
+	}
+	for (auto& w : workers)
+		w.join();
+
+	float sec = timer.end();
+	return (double)threads * BATCH * ROUNDS / (double)sec;
+}
+
+int main () {
+	printf("%d x %d alloc+free per thread, %u hardware threads\n\n", ROUNDS, BATCH, std::thread::hardware_concurrency());
+	printf("  threads   ConcurrentBlockAllocator [Mops/s]   BlockAllocator + mutex [Mops/s]\n");
+
+	for (int threads=1; threads<=32; threads*=2) {
+		double concurrent = 0, locked = 0;
+
+		for (int rep=0; rep<3; ++rep) {
+			{
+				ConcurrentBlockAllocator<Slot> a (MAX_SLOTS);
+				concurrent = std::max(concurrent, run(threads,
+					[&] () { return a.alloc(); },
+					[&] (uint32_t idx) { a.free(idx); },
+					[&] (uint32_t idx) -> Slot& { return a[idx]; }));
+			}
+			{
+				LockedBlockAllocator a;
+				locked = std::max(locked, run(threads,
+					[&] () { std::lock_guard lock(a.mutex); return a.alloc.alloc(); },
+					[&] (uint32_t idx) { std::lock_guard lock(a.mutex); a.alloc.free(idx); },
+					// operator[] does not touch allocator state, pages of allocated slots stay committed
+					[&] (uint32_t idx) -> Slot& { return a.alloc[idx]; }));
+			}
+		}
+
+		printf("  %7d   %33.2f   %31.2f\n", threads, concurrent / 1e6, locked / 1e6);
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+// Frame throughput of Engine::pipelined mode (update frame N+1 on the main thread while a render thread renders frame N) against serial update + render
+// update and render are simulated with a calibrated amount of cpu work, the hand-off is the same as in engine.cpp (_submitted_frames / _rendered_frames with FRAME_PACKETS slots)
+// the render thread runs either on MAIN_THREAD_CORE like the main thread (what happens if it inherits the main thread's affinity) or excludes it like engine.cpp does now
+// with perfect overlap a pipelined frame takes max(update, render) instead of update + render
+// not part of any build, compile from the repo root with the same include paths as the engine (for tracy/Tracy.hpp):
+//  g++ -std=c++20 -O2 -I. -I<deps> kisslib/bench/bench_pipelining.cpp kisslib/threadpool.cpp kisslib/string.cpp kisslib/timer.cpp -lpthread
+//  (msvc: add the same files to an empty console project, set_thread_preferred_core/set_thread_excluded_core are no-ops on windows)
+#include "kisslib/threadpool.hpp"
+#include <atomic>
+#include <cstdio>
+
+static constexpr int FRAMES = 500;
+static constexpr uint64_t FRAME_PACKETS = 2;
+
+// fixed amount of cpu work instead of spinning until a timestamp, so that two threads sharing a core take twice as long
+static uint64_t iters_per_us = 0;
+
+static uint64_t work (uint64_t iters) {
+	uint64_t x = 0x9E3779B97F4A7C15ull;
+	for (uint64_t i=0; i<iters; ++i) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+	return x;
+}
+static volatile uint64_t sink;
+
+static void work_us (float us) {
+	sink = work((uint64_t)(us * (float)iters_per_us));
+}
+
+static void calibrate () {
+	uint64_t iters = 1 << 24;
+	auto timer = kiss::Timer::start();
+	sink = work(iters);
+	iters_per_us = (uint64_t)((double)iters / ((double)timer.end() * 1e6));
+}
+
+static void wait_for_frames (std::atomic<uint64_t>& frames, uint64_t target) {
+	for (;;) {
+		uint64_t cur = frames.load(std::memory_order_acquire);
+		if (cur >= target)
+			return;
+		frames.wait(cur, std::memory_order_acquire);
+	}
+}
+
+// returns frames per second
+static double run_serial (float update_us, float render_us) {
+	auto timer = kiss::Timer::start();
+	for (int i=0; i<FRAMES; ++i) {
+		work_us(update_us);
+		work_us(render_us);
+	}
+	return (double)FRAMES / (double)timer.end();
+}
+
+// returns frames per second
+static double run_pipelined (float update_us, float render_us, bool render_on_main_core) {
+	std::atomic<uint64_t> submitted = 0, rendered = 0;
+
+	std::thread render_thread ([&] () {
+		set_thread_priority(TPRIO_MAIN);
+		if (render_on_main_core)
+			set_thread_preferred_core(MAIN_THREAD_CORE);
+		else
+			set_thread_excluded_core(MAIN_THREAD_CORE);
+
+		for (uint64_t frame = 1; frame <= FRAMES; ++frame) {
+			wait_for_frames(submitted, frame);
+			work_us(render_us);
+			rendered.store(frame, std::memory_order_release);
+			rendered.notify_all();
+		}
+	});
+
+	// like main_loop, pinned after starting the render thread
+	set_thread_preferred_core(MAIN_THREAD_CORE);
+
+	auto timer = kiss::Timer::start();
+	for (uint64_t frame = 1; frame <= FRAMES; ++frame) {
+		if (frame > FRAME_PACKETS)
+			wait_for_frames(rendered, frame - FRAME_PACKETS);
+		work_us(update_us);
+		submitted.store(frame, std::memory_order_release);
+		submitted.notify_all();
+	}
+	wait_for_frames(rendered, FRAMES);
+	double fps = (double)FRAMES / (double)timer.end();
+
+	render_thread.join();
+	return fps;
+}
+
+int main () {
+	set_thread_priority(TPRIO_MAIN);
+	calibrate();
+
+	printf("%d frames per run, best of 3, %d physical cores (the render thread can only overlap with more than one)\n\n",
+		FRAMES, get_cpu_topology().physical_cores);
+	printf("  update [ms]   render [ms]   serial [fps]   pipelined, render on main core [fps]   pipelined, render excludes main core [fps]\n");
+
+	struct Case { float update_us, render_us; };
+	Case cases[] = {
+		{ 2000, 2000 },
+		{ 4000, 2000 },
+		{ 2000, 4000 },
+		{ 6000, 1000 },
+	};
+
+	for (auto& c : cases) {
+		double serial = 0, same_core = 0, other_core = 0;
+		for (int rep=0; rep<3; ++rep) {
+			serial     = std::max(serial,     run_serial(c.update_us, c.render_us));
+			same_core  = std::max(same_core,  run_pipelined(c.update_us, c.render_us, true));
+			other_core = std::max(other_core, run_pipelined(c.update_us, c.render_us, false));
+		}
+		printf("  %11.1f   %11.1f   %12.1f   %36.1f   %41.1f\n", c.update_us / 1000, c.render_us / 1000, serial, same_core, other_core);
+	}
+	return 0;
+}
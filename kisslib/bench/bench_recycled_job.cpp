@@ -0,0 +1,111 @@
+// Benchmark for RecycledJob against plain std::make_unique jobs
+// alloc: make_unique + free of a job on one thread, which is the best case for both
+// pool:  the main thread pushes batches of jobs through a Threadpool and frees them after popping the results,
+//        like chunk jobs in a game, so jobs are allocated and freed on the main thread but touched by the workers
+// prints RecycledJob::stats after each run, in steady state heap allocs should stay at the size of the largest batch in flight
+// not part of any build, compile from the repo root with the same include paths as the engine (for tracy/Tracy.hpp):
+//  g++ -std=c++20 -O2 -DNDEBUG -I. -I<deps> kisslib/bench/bench_recycled_job.cpp kisslib/threadpool.cpp kisslib/string.cpp kisslib/timer.cpp -lpthread
+//  (msvc: add the same files to an empty console project)
+#include "kisslib/threadpool.hpp"
+#include <cstdio>
+
+// same payload for both, a few cache lines like a typical job with some parameters and a small result
+struct PlainJob {
+	CountdownLatch*	latch = nullptr;
+	uint64_t		data[15] = {};
+
+	void execute () {
+		for (int i=0; i<15; ++i)
+			data[i] = data[i] * 0x9E3779B97F4A7C15ull + (uint64_t)i;
+	}
+};
+struct RecycledBenchJob : RecycledJob<RecycledBenchJob> {
+	CountdownLatch*	latch = nullptr;
+	uint64_t		data[15] = {};
+
+	void execute () {
+		for (int i=0; i<15; ++i)
+			data[i] = data[i] * 0x9E3779B97F4A7C15ull + (uint64_t)i;
+	}
+};
+
+static constexpr int ALLOCS = 1 << 22;
+static constexpr int JOBS = 1 << 18;
+static constexpr int BATCH = 1024;
+
+// returns ns per job
+template <typename JOB>
+static double run_alloc () {
+	auto timer = kiss::Timer::start();
+	for (int i=0; i<ALLOCS; ++i) {
+		auto job = std::make_unique<JOB>();
+		job->execute(); // so the allocation is not optimized away
+	}
+	return (double)timer.end() / ALLOCS * 1e9;
+}
+
+// returns ns per job
+template <typename JOB>
+static double run_pool (Threadpool<JOB>& pool) {
+	std::vector<std::unique_ptr<JOB>> results;
+	results.reserve(BATCH);
+
+	auto timer = kiss::Timer::start();
+	for (int b=0; b<JOBS/BATCH; ++b) {
+		CountdownLatch latch (BATCH);
+		for (int i=0; i<BATCH; ++i) {
+			auto job = std::make_unique<JOB>();
+			job->latch = &latch;
+			pool.jobs.push(std::move(job));
+		}
+		latch.wait();
+
+		pool.results.pop_all(&results);
+		results.clear(); // frees the jobs on the main thread
+	}
+	return (double)timer.end() / JOBS * 1e9;
+}
+
+static void print_stats (char const* when) {
+	auto& s = RecycledBenchJob::stats;
+	printf("    RecycledJob::stats %-14s heap %10llu   recycled %10llu   frees %10llu\n", when,
+		(unsigned long long)s.heap_allocs.load(), (unsigned long long)s.recycled_allocs.load(), (unsigned long long)s.frees.load());
+}
+
+int main () {
+	static_assert(JOBS % BATCH == 0);
+	printf("alloc: %d jobs of %zu bytes on one thread, pool: %d jobs in batches of %d, %u hardware threads\n\n",
+		ALLOCS, sizeof(RecycledBenchJob), JOBS, BATCH, std::thread::hardware_concurrency());
+
+	{
+		double plain = 1e30, recycled = 1e30;
+		for (int rep=0; rep<3; ++rep) {
+			plain = std::min(plain, run_alloc<PlainJob>());
+			recycled = std::min(recycled, run_alloc<RecycledBenchJob>());
+		}
+		printf("alloc\n");
+		printf("  make_unique [ns/job]   RecycledJob [ns/job]\n");
+		printf("  %20.1f   %20.1f\n", plain, recycled);
+		print_stats("after alloc");
+		printf("\n");
+	}
+
+	printf("pool\n");
+	printf("  threads   make_unique [ns/job]   RecycledJob [ns/job]\n");
+	for (int threads : { 1, 2, 4, 8 }) {
+		double plain = 1e30, recycled = 1e30;
+		{
+			Threadpool<PlainJob> pool (threads, TPRIO_PARALLELISM, "plain");
+			for (int rep=0; rep<3; ++rep)
+				plain = std::min(plain, run_pool(pool));
+		}
+		{
+			Threadpool<RecycledBenchJob> pool (threads, TPRIO_PARALLELISM, "recycled");
+			for (int rep=0; rep<3; ++rep)
+				recycled = std::min(recycled, run_pool(pool));
+		}
+		printf("  %7d   %20.1f   %20.1f\n", threads, plain, recycled);
+		print_stats("total");
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+// Contention benchmark for Threadpool, TPOOL_SHARED_QUEUE vs TPOOL_WORK_STEALING on 1-64 threads
+// inject: the main thread pushes all jobs into the jobs queue (the injector in work stealing mode)
+// spawn:  a few root jobs spawn() the rest from inside the pool (shared queue mode: same as pushing to the jobs queue)
+// jobs are tiny (empty) or small (~1us), so the numbers are dominated by queue overhead
+// not part of any build, compile from the repo root with the same include paths as the engine (for tracy/Tracy.hpp):
+//  g++ -std=c++20 -O2 -I. -I<deps> kisslib/bench/bench_threadpool.cpp kisslib/threadpool.cpp kisslib/string.cpp kisslib/timer.cpp -lpthread
+//  (msvc: add the same files to an empty console project)
+#include "kisslib/threadpool.hpp"
+#include <cstdio>
+
+struct BenchJob;
+using BenchPool = Threadpool<BenchJob>;
+
+struct BenchJob {
+	CountdownLatch*	latch = nullptr;
+	BenchPool*		pool = nullptr;
+	int				work = 0; // xorshift iterations
+	int				children = 0; // jobs to spawn()
+	uint64_t		result = 0;
+
+	void execute ();
+};
+
+void BenchJob::execute () {
+	for (int i=0; i<children; ++i) {
+		auto job = std::make_unique<BenchJob>();
+		job->latch = latch;
+		job->work = work;
+		pool->spawn(std::move(job));
+	}
+
+	uint64_t x = 0x9E3779B97F4A7C15ull + (uint64_t)work;
+	for (int i=0; i<work; ++i) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+	result = x;
+}
+
+static constexpr int JOBS = 200000;
+
+// returns jobs per second
+static double run (BenchPool& pool, bool spawn, int work) {
+	CountdownLatch latch (JOBS);
+	auto timer = kiss::Timer::start();
+
+	if (spawn) {
+		// 64 roots, so every thread count has roots to start with
+		int roots = 64;
+		for (int i=0; i<roots; ++i) {
+			auto job = std::make_unique<BenchJob>();
+			job->latch = &latch;
+			job->pool = &pool;
+			job->work = work;
+			job->children = JOBS / roots - 1;
+			pool.jobs.push(std::move(job));
+		}
+	}
+	else {
+		for (int i=0; i<JOBS; ++i) {
+			auto job = std::make_unique<BenchJob>();
+			job->latch = &latch;
+			job->work = work;
+			pool.jobs.push(std::move(job));
+		}
+	}
+
+	latch.wait();
+	float sec = timer.end();
+
+	pool.results.clear();
+	return (double)JOBS / (double)sec;
+}
+
+int main () {
+	static_assert(JOBS % 64 == 0);
+
+	printf("%d jobs per run, %u hardware threads (thread counts above that oversubscribe)\n\n",
+		JOBS, std::thread::hardware_concurrency());
+
+	struct Case { char const* name; bool spawn; int work; };
+	Case cases[] = {
+		{ "inject, empty jobs", false, 0 },
+		{ "inject, ~1us jobs",  false, 400 },
+		{ "spawn,  empty jobs", true,  0 },
+		{ "spawn,  ~1us jobs",  true,  400 },
+	};
+
+	for (auto& c : cases) {
+		printf("%s\n", c.name);
+		printf("  threads   shared queue [Mjobs/s]   work stealing [Mjobs/s]\n");
+
+		for (int threads=1; threads<=64; threads*=2) {
+			double rate[2];
+			ThreadpoolMode modes[2] = { TPOOL_SHARED_QUEUE, TPOOL_WORK_STEALING };
+			for (int m=0; m<2; ++m) {
+				BenchPool pool (threads, TPRIO_PARALLELISM, "bench", modes[m]);
+				run(pool, c.spawn, c.work); // warm up
+
+				double best = 0;
+				for (int rep=0; rep<3; ++rep)
+					best = std::max(best, run(pool, c.spawn, c.work));
+				rate[m] = best;
+			}
+			printf("  %7d   %22.2f   %23.2f\n", threads, rate[0] / 1e6, rate[1] / 1e6);
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+// Latency of Threadpool::flush() and shutdown() with a bounded results queue (ThreadsafeRingQueue) that nobody pops
+// full: more jobs than the results ring holds, so every thread ends up blocked pushing it's result when flush() is called
+// (this used to deadlock, flush() waited for acks from threads that waited for space in results)
+// empty: the same pool with all results popped, as a baseline
+// not part of any build, compile from the repo root with the same include paths as the engine (for tracy/Tracy.hpp):
+//  g++ -std=c++20 -O2 -I. -I<deps> kisslib/bench/bench_threadpool_flush.cpp kisslib/threadpool.cpp kisslib/string.cpp kisslib/timer.cpp -lpthread
+//  (msvc: add the same files to an empty console project)
+#include "kisslib/threadpool.hpp"
+#include <cstdio>
+
+struct FlushJob {
+	CountdownLatch*	latch = nullptr;
+	void execute () {}
+};
+using FlushPool = Threadpool<FlushJob, ThreadsafeQueue, ThreadsafeRingQueue>;
+
+static constexpr int RESULTS = 64;
+static constexpr int REPS = 20;
+
+static void push_jobs (FlushPool& pool, int count, CountdownLatch* latch) {
+	for (int i=0; i<count; ++i) {
+		auto job = std::make_unique<FlushJob>();
+		job->latch = latch;
+		pool.jobs.push(std::move(job));
+	}
+}
+
+// returns the max flush() time in ms
+static float run_flush (int threads, ThreadpoolMode mode, bool full) {
+	FlushPool pool (threads, TPRIO_PARALLELISM, "flush", mode);
+	pool.results.resize(RESULTS);
+
+	float worst = 0;
+	for (int rep=0; rep<REPS; ++rep) {
+		if (full) {
+			// every thread runs a job after the ring is full, the rest stay queued
+			push_jobs(pool, RESULTS + threads * 4, nullptr);
+			while (!pool.results.full())
+				std::this_thread::yield();
+		}
+		else {
+			CountdownLatch latch (RESULTS);
+			push_jobs(pool, RESULTS, &latch);
+			latch.wait();
+			pool.results.clear();
+		}
+
+		pool.flush();
+		worst = std::max(worst, pool.last_flush_time * 1000);
+
+		if (!pool.results.empty()) {
+			printf("flush() left results in the queue\n");
+			exit(1);
+		}
+	}
+
+	// shutdown with threads blocked on the full ring
+	if (full)
+		push_jobs(pool, RESULTS + threads * 4, nullptr);
+	pool.shutdown();
+	return worst;
+}
+
+int main () {
+	printf("results ring of %d, worst of %d flushes, %u hardware threads\n\n", RESULTS, REPS, std::thread::hardware_concurrency());
+	printf("  threads   mode            flush, results empty [ms]   flush, results full [ms]\n");
+
+	for (int threads=1; threads<=16; threads*=2) {
+		for (ThreadpoolMode mode : { TPOOL_SHARED_QUEUE, TPOOL_WORK_STEALING }) {
+			float empty = run_flush(threads, mode, false);
+			float full = run_flush(threads, mode, true);
+			printf("  %7d   %-14s  %26.3f   %24.3f\n", threads, mode == TPOOL_SHARED_QUEUE ? "shared queue" : "work stealing", empty, full);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,92 @@
+// Benchmark for TlsfAllocator against the system malloc (glibc on linux) on an engine-like alloc/free mix
+// sizes: mostly small (strings, small arrays), some medium (per-chunk vertex vectors), a few large (meshes)
+// every op frees a random live allocation and allocates a new one in it's place, so lifetimes are random
+// not part of any build, compile from the repo root with the same include paths as the engine (for tracy/Tracy.hpp):
+//  g++ -std=c++20 -O2 -DNDEBUG -I. -I<deps> kisslib/bench/bench_tlsf_allocator.cpp kisslib/tlsf_allocator.cpp kisslib/allocator.cpp kisslib/timer.cpp -lpthread
+//  (msvc: add the same files to an empty console project, compares against the msvc crt malloc instead)
+// build with MEMORY_TRACKING=0 (the default with NDEBUG), else the tracking atomics dominate the tlsf fast path
+#include "kisslib/tlsf_allocator.hpp"
+#include "kisslib/timer.hpp"
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+static constexpr int OPS = 1 << 21;
+static constexpr int LIVE = 8192; // allocations alive at any time per thread
+
+struct Rng {
+	uint64_t state;
+	uint32_t next () {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (uint32_t)(state >> 32);
+	}
+};
+
+static size_t mix_size (Rng& rng) {
+	uint32_t r = rng.next() % 1000;
+	if (r < 900) return 16 + rng.next() % 496;          // 90% small
+	if (r < 995) return 1*KB + rng.next() % (63*KB);    // 9.5% medium
+	return 256*KB + rng.next() % (768*KB);              // 0.5% large
+}
+
+// returns seconds
+template <typename ALLOC, typename FREE>
+static double run (int threads, ALLOC alloc, FREE free) {
+	auto timer = kiss::Timer::start();
+
+	std::vector<std::thread> workers;
+	for (int t=0; t<threads; ++t) {
+		workers.emplace_back([=] () {
+			Rng rng = { 0x9E3779B97F4A7C15ull * (uint64_t)(t + 1) };
+			std::vector<void*> live (LIVE, nullptr);
+
+			for (int i=0; i<OPS; ++i) {
+				void*& slot = live[rng.next() % LIVE];
+				free(slot);
+
+				size_t size = mix_size(rng);
+				slot = alloc(size);
+				*(volatile char*)slot = 1; // touch like real code would
+			}
+			for (void* ptr : live)
+				free(ptr);
+		});
+	}
+	for (auto& w : workers)
+		w.join();
+
+	return timer.end();
+}
+
+int main () {
+	printf("%d ops per thread (free + alloc), %d live allocations per thread, %u hardware threads\n\n", OPS, LIVE, std::thread::hardware_concurrency());
+	printf("  threads   tlsf [ns/op]   malloc [ns/op]\n");
+
+	TlsfAllocator tlsf (16*GB);
+
+	for (int threads : { 1, 2, 4, 8 }) {
+		double t_tlsf = 1e30, t_malloc = 1e30;
+		for (int rep=0; rep<3; ++rep) {
+			t_tlsf = std::min(t_tlsf, run(threads,
+				[&] (size_t size) { return tlsf.alloc(size); },
+				[&] (void* ptr) { tlsf.free(ptr); }));
+			t_malloc = std::min(t_malloc, run(threads,
+				[] (size_t size) { return malloc(size); },
+				[] (void* ptr) { ::free(ptr); }));
+		}
+
+		// wall time divided by the ops of one thread, stays flat if the allocator scales perfectly (and there are enough cores)
+		double ops = (double)OPS;
+		printf("  %7d   %12.1f   %14.1f\n", threads, t_tlsf / ops * 1e9, t_malloc / ops * 1e9);
+	}
+
+	// exited threads returned their caches, committed memory is still held by the RetentionPolicy (high-water mark of the last 5 sec)
+	auto s = tlsf.stats();
+	printf("\ntlsf after all runs: used %zu  free %zu in %zu blocks  committed %.1f MB  fragmentation %.2f  commits %llu  decommits %llu\n",
+		s.used, s.free, s.free_blocks, (double)s.committed / MB, s.fragmentation(),
+		(unsigned long long)s.commit_calls, (unsigned long long)s.decommit_calls);
+	return 0;
+}
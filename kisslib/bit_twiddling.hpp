@@ -18,3 +18,49 @@ inline uint64_t upper_power_of_two (uint64_t v) {
 	v++;
 	return v;
 }
+
+//// Morton order (Z-order) for 3d coordinates, bits of x,y,z are interleaved as ...z1y1x1z0y0x0
+// 21 bits per axis
+
+// dilated masks, all bits belonging to one axis
+inline constexpr uint64_t MORTON3_X = 0x1249249249249249ull;
+inline constexpr uint64_t MORTON3_Y = MORTON3_X << 1;
+inline constexpr uint64_t MORTON3_Z = MORTON3_X << 2;
+
+// insert two zero bits between each of the lower 21 bits
+inline constexpr uint64_t morton3_spread (uint64_t v) {
+	v &= 0x1fffffull;
+	v = (v | v << 32) & 0x001f00000000ffffull;
+	v = (v | v << 16) & 0x001f0000ff0000ffull;
+	v = (v | v <<  8) & 0x100f00f00f00f00full;
+	v = (v | v <<  4) & 0x10c30c30c30c30c3ull;
+	v = (v | v <<  2) & 0x1249249249249249ull;
+	return v;
+}
+// inverse of morton3_spread
+inline constexpr uint64_t morton3_compact (uint64_t v) {
+	v &= 0x1249249249249249ull;
+	v = (v | v >>  2) & 0x10c30c30c30c30c3ull;
+	v = (v | v >>  4) & 0x100f00f00f00f00full;
+	v = (v | v >>  8) & 0x001f0000ff0000ffull;
+	v = (v | v >> 16) & 0x001f00000000ffffull;
+	v = (v | v >> 32) & 0x1fffffull;
+	return v;
+}
+
+inline constexpr uint64_t morton3_encode (uint32_t x, uint32_t y, uint32_t z) {
+	return morton3_spread(x) | (morton3_spread(y) << 1) | (morton3_spread(z) << 2);
+}
+inline constexpr void morton3_decode (uint64_t m, uint32_t* x, uint32_t* y, uint32_t* z) {
+	*x = (uint32_t)morton3_compact(m);
+	*y = (uint32_t)morton3_compact(m >> 1);
+	*z = (uint32_t)morton3_compact(m >> 2);
+}
+
+// +1 / -1 along the axis given by its dilated mask without decoding (carries skip the bits of the other axes)
+inline constexpr uint64_t morton3_inc (uint64_t m, uint64_t axis_mask) {
+	return (((m | ~axis_mask) + 1) & axis_mask) | (m & ~axis_mask);
+}
+inline constexpr uint64_t morton3_dec (uint64_t m, uint64_t axis_mask) {
+	return (((m & axis_mask) - 1) & axis_mask) | (m & ~axis_mask);
+}
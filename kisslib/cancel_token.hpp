@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include "stdint.h"
+#include "macros.hpp"
+
+class CancelSource;
+
+// cooperative cancellation for jobs
+// a token is cancelled either directly via cancel() or by cancelling the CancelSource it was created from
+// Threadpool skips jobs whose 'CancelToken cancel_token' member is cancelled (see Threadpool), long jobs can poll is_cancelled() to stop early
+// the source needs to outlive all tokens created from it
+struct CancelToken {
+	NO_MOVE_COPY_CLASS(CancelToken)
+
+	std::atomic<bool>	flag = false;
+	CancelSource const*	source = nullptr;
+	uint32_t			generation = 0;
+
+	CancelToken () {}
+	inline CancelToken (CancelSource const& source);
+
+	// cancel only this token
+	void cancel () {
+		flag.store(true, std::memory_order_relaxed);
+	}
+
+	inline bool is_cancelled () const;
+};
+
+// owner of a group of tokens (ie. one per chunk or one per level load)
+// cancel() cancels all tokens handed out so far, tokens created afterwards are live again
+// so a chunk can cancel it's stale jobs and queue new ones with the same source
+class CancelSource {
+	NO_MOVE_COPY_CLASS(CancelSource)
+
+	std::atomic<uint32_t> generation = 0;
+
+	friend struct CancelToken;
+public:
+	CancelSource () {}
+
+	void cancel () {
+		generation.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+
+CancelToken::CancelToken (CancelSource const& source):
+	source{&source}, generation{source.generation.load(std::memory_order_relaxed)} {}
+
+bool CancelToken::is_cancelled () const {
+	// relaxed is fine, cancellation is only a hint to skip work, a late cancel just means the job runs anyway
+	return flag.load(std::memory_order_relaxed) ||
+		(source && source->generation.load(std::memory_order_relaxed) != generation);
+}
@@ -0,0 +1,225 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+#include "allocator.hpp"
+
+// BlockAllocator that can alloc and free from any thread at the same time
+// same index based interface and commit-on-demand, so worker threads can create chunk data without going through the main thread
+//  slots are claimed lock-free in an atomic bitset (1 = free like AllocatorBitset) via fetch_and
+//  every thread remembers the word it last allocated from, so threads allocating at the same time mostly work on different words
+//  commits happen under a mutex, but only when an index past the committed region is claimed
+// unlike BlockAllocator free() never decommits (another thread might be about to use the pages), call trim() at a point where no allocs or frees run
+template <typename T>
+class ConcurrentBlockAllocator {
+	NO_MOVE_COPY_CLASS(ConcurrentBlockAllocator)
+
+	T*			arr;
+	uint32_t	max_count;
+	size_t		reserve_size;
+	size_t		page_size; // commit granularity
+
+	uint32_t								word_count;
+	std::unique_ptr<std::atomic<uint64_t>[]>	bits;
+
+	std::atomic<uint32_t>	count = 0;
+	std::atomic<uint32_t>	first_free_word = 0; // no free bits before this word (can be too low, but never too high, see _claim)
+	std::atomic<size_t>		commit_size_ = 0;
+	std::mutex				commit_mutex;
+	MemTag					tag = MEMTAG_OTHER;
+
+	struct Hint {
+		ConcurrentBlockAllocator const*	owner = nullptr;
+		uint32_t						word = 0;
+	};
+	static inline thread_local Hint hint;
+
+	// try to claim a free bit in word i, returns false if the word is full
+	bool _try_claim (uint32_t i, uint32_t* idx) {
+		uint64_t word = bits[i].load(std::memory_order_relaxed);
+		while (word != 0ull) {
+			uint64_t bit = 1ull << _bsf_1(word);
+			// acquire: see the writes of the thread that freed this slot
+			uint64_t prev = bits[i].fetch_and(~bit, std::memory_order_acquire);
+			if (prev & bit) {
+				*idx = (i << 6) + _bsf_1(bit);
+				return true;
+			}
+			word = prev & ~bit; // lost the race for this bit, retry with the updated word
+		}
+		return false;
+	}
+
+	uint32_t _claim () {
+		uint32_t first = first_free_word.load(std::memory_order_relaxed);
+		uint32_t start = first;
+		if (hint.owner == this && hint.word > start)
+			start = hint.word;
+
+		// count was reserved before calling this, so a free bit exists, but frees can race with the scan, so retry until one is found
+		for (;;) {
+			uint32_t idx;
+			for (uint32_t i=start; i<word_count; ++i) {
+				if (_try_claim(i, &idx)) {
+					hint = { this, i };
+					// words before i were full, skip them next time (fails if a free lowered it in the meantime)
+					if (start == first && i > first && first_free_word.compare_exchange_strong(first, i, std::memory_order_seq_cst)) {
+						// a free() into [first, i) can have read first_free_word before we raised it and not lowered it
+						// free() sets it's bit before reading first_free_word, so either it sees our raise or we see it's bit here
+						for (uint32_t j=first; j<i; ++j) {
+							if (bits[j].load(std::memory_order_seq_cst) != 0ull) {
+								_lower_first_free(j);
+								break;
+							}
+						}
+					}
+					return idx;
+				}
+			}
+			start = 0;
+			first = (uint32_t)-1;
+		}
+	}
+
+	void _lower_first_free (uint32_t word) {
+		uint32_t first = first_free_word.load(std::memory_order_seq_cst);
+		while (word < first && !first_free_word.compare_exchange_weak(first, word, std::memory_order_seq_cst));
+	}
+
+	void _commit (size_t needed) {
+		std::lock_guard lock(commit_mutex);
+
+		size_t committed = commit_size_.load(std::memory_order_relaxed);
+		if (needed <= committed)
+			return; // another thread committed it already
+
+		size_t new_commit = round_up_to_granularity(needed, page_size);
+		commit_pages((char*)arr + committed, new_commit - committed);
+
+		// Memory is zero inited
+		commit_size_.store(new_commit, std::memory_order_release);
+	}
+
+public:
+	// large_pages: commit in 2MB pages, see reserve_address_space
+	ConcurrentBlockAllocator (uint32_t max_count, bool large_pages=false): max_count{max_count} {
+		page_size = get_commit_granularity(large_pages);
+		reserve_size = round_up_to_granularity((size_t)max_count * sizeof(T), page_size);
+
+		arr = (T*)reserve_address_space(reserve_size, large_pages);
+
+		word_count = (max_count + 63) / 64;
+		bits = std::make_unique<std::atomic<uint64_t>[]>(word_count);
+		for (uint32_t i=0; i<word_count; ++i) {
+			uint32_t valid = std::min(max_count - (i << 6), 64u);
+			bits[i].store(valid == 64 ? ONES : (1ull << valid) - 1, std::memory_order_relaxed);
+		}
+	}
+	~ConcurrentBlockAllocator () {
+		uint32_t live = count.load(std::memory_order_relaxed);
+		MEMTRACK_FREE_N(tag, (size_t)live * sizeof(T), live);
+		release_address_space(arr, reserve_size);
+	}
+
+	T& operator[] (uint32_t idx) {
+		return arr[idx];
+	}
+	T const& operator[] (uint32_t idx) const {
+		return arr[idx];
+	}
+
+	// threadsafe
+	uint32_t alloc () {
+		ALLOCATOR_PROFILE_SCOPED("ConcurrentBlockAllocator::alloc");
+
+		if (count.fetch_add(1, std::memory_order_relaxed) >= max_count) {
+			count.fetch_sub(1, std::memory_order_relaxed);
+			throw std::runtime_error("ConcurrentBlockAllocator: max_count reached!");
+		}
+
+		uint32_t idx = _claim();
+
+		size_t new_end = (size_t)(idx +1) * sizeof(T);
+		if (new_end > commit_size_.load(std::memory_order_acquire)) // commit pages when needed
+			_commit(new_end);
+
+		ALLOCATOR_PROFILE_ALLOC(&arr[idx], sizeof(T))
+		MEMTRACK_ALLOC(tag, sizeof(T));
+		return idx;
+	}
+
+	// threadsafe
+	void free (uint32_t idx) {
+		ALLOCATOR_PROFILE_SCOPED("ConcurrentBlockAllocator::free");
+
+		assert(is_allocated(idx));
+		ALLOCATOR_PROFILE_FREE(&arr[idx])
+		MEMTRACK_FREE(tag, sizeof(T));
+
+		uint32_t word = idx >> 6;
+		// release: the next thread to claim this slot sees our writes
+		// seq_cst: ordered before reading first_free_word, pairs with the recheck in _claim
+		bits[word].fetch_or(1ull << (idx & 63), std::memory_order_seq_cst);
+
+		count.fetch_sub(1, std::memory_order_relaxed);
+
+		_lower_first_free(word);
+	}
+
+	// category the slots count towards in g_mem_tracker, not threadsafe with concurrent allocs and frees
+	void set_tag (MemTag new_tag) {
+		uint32_t live = count.load(std::memory_order_relaxed);
+		MEMTRACK_FREE_N(tag, (size_t)live * sizeof(T), live);
+		MEMTRACK_ALLOC_N(new_tag, (size_t)live * sizeof(T), live);
+		tag = new_tag;
+	}
+
+	bool is_allocated (uint32_t idx) const {
+		assert(idx < max_count);
+		return (bits[idx >> 6].load(std::memory_order_relaxed) & (1ull << (idx & 63))) == 0;
+	}
+
+	// index of the last allocated slot plus 1, not threadsafe with concurrent allocs and frees
+	uint32_t alloc_end () const {
+		for (uint32_t i=word_count; i-- > 0;) {
+			uint64_t word = bits[i].load(std::memory_order_relaxed);
+			uint32_t valid = std::min(max_count - (i << 6), 64u);
+			uint64_t mask = valid == 64 ? ONES : (1ull << valid) - 1;
+			if ((word & mask) != mask)
+				return (i << 6) + _bsr_0(word | ~mask) + 1;
+		}
+		return 0;
+	}
+
+	// decommit pages past the last allocated slot and reset first_free_word
+	// not threadsafe, no alloc() or free() may run at the same time
+	void trim () {
+		size_t committed = commit_size_.load(std::memory_order_relaxed);
+		size_t target = round_up_to_granularity((size_t)alloc_end() * sizeof(T), page_size);
+		if (target < committed) {
+			decommit_pages((char*)arr + target, committed - target);
+			commit_size_.store(target, std::memory_order_relaxed);
+		}
+
+		uint32_t first = 0;
+		while (first < word_count && bits[first].load(std::memory_order_relaxed) == 0ull)
+			first++;
+		first_free_word.store(first, std::memory_order_relaxed);
+	}
+
+	uint32_t size () const {
+		return count.load(std::memory_order_relaxed);
+	}
+	// how many bytes are commited
+	size_t commit_size () const {
+		return commit_size_.load(std::memory_order_relaxed);
+	}
+	// ratio of allocated bytes to commited bytes
+	float usage () const {
+		return (float)(size() * sizeof(T)) / (float)commit_size();
+	}
+};
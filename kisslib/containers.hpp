@@ -2,18 +2,348 @@
 #include "kissmath/output/int3.hpp"
 #include "macros.hpp"
 #include "assert.h"
+#include "bit_twiddling.hpp"
+#include <cstring>
+#include <type_traits>
+
+//// array3D layouts
+// a layout maps 3d positions to storage indices
+//  size_t count () const								allocated elements (>= x*y*z, some layouts pad)
+//  size_t index (int x, int y, int z) const
+//  size_t neighbour (size_t idx, int x, int y, int z, int face) const	index of the face neighbour of (x,y,z), which has to be inside the array
+//  void for_each (FUNC func) const						func(int x, int y, int z, size_t idx) for every position in storage order
+//  void for_each_neighbours (FUNC func) const			func(int x, int y, int z, size_t idx, OFFSETS const& offsets, INSIDE inside) like for_each,
+//														 offsets[face] is the index offset to each neighbour, only valid if bit face of inside is set (neighbour is inside the array)
+//														 interior rows/bricks pass AllFacesInside, so the border checks compile away for most positions,
+//														 border positions pass a uint32_t, so the interior call is it's own instantiation of func, which gets inlined since it's only called there
+// faces: 0:-X 1:+X 2:-Y 3:+Y 4:-Z 5:+Z
+
+inline constexpr uint32_t ALL_FACES_INSIDE = 0x3f;
+using AllFacesInside = std::integral_constant<uint32_t, ALL_FACES_INSIDE>;
+
+// bit face is set if the face neighbour of (x,y,z) is inside of size
+inline uint32_t inside_faces (int x, int y, int z, int3 const& size) {
+	return (uint32_t)(x > 0) | (uint32_t)(x < size.x-1) << 1 |
+	       (uint32_t)(y > 0) << 2 | (uint32_t)(y < size.y-1) << 3 |
+	       (uint32_t)(z > 0) << 4 | (uint32_t)(z < size.z-1) << 5;
+}
+
+// x-major rows, the y and z neighbours of a voxel are size.x and size.x*size.y elements away
+struct FlatLayout {
+	int3	size = 0;
+	size_t	stride_y = 0;
+	size_t	stride_z = 0;
 
-template <typename T>
+	void init (int3 const& new_size) {
+		size = new_size;
+		stride_y = (size_t)size.x;
+		stride_z = (size_t)size.x * size.y;
+	}
+	size_t count () const {
+		return stride_z * size.z;
+	}
+
+	size_t index (int x, int y, int z) const {
+		return (size_t)z * stride_z + (size_t)y * stride_y + x;
+	}
+	size_t neighbour (size_t idx, int x, int y, int z, int face) const {
+		size_t stride = face < 2 ? 1 : (face < 4 ? stride_y : stride_z);
+		return face & 1 ? idx + stride : idx - stride;
+	}
+
+	template <typename FUNC>
+	void for_each (FUNC func) const {
+		size_t idx = 0;
+		for (int z=0; z<size.z; ++z)
+		for (int y=0; y<size.y; ++y)
+		for (int x=0; x<size.x; ++x) {
+			func(x,y,z, idx++);
+		}
+	}
+	template <typename FUNC>
+	void for_each_neighbours (FUNC func) const {
+		ptrdiff_t offsets[6] = { -1, 1, -(ptrdiff_t)stride_y, (ptrdiff_t)stride_y, -(ptrdiff_t)stride_z, (ptrdiff_t)stride_z };
+		size_t idx = 0;
+		for (int z=0; z<size.z; ++z)
+		for (int y=0; y<size.y; ++y) {
+			if (y == 0 || y == size.y-1 || z == 0 || z == size.z-1 || size.x < 3) {
+				for (int x=0; x<size.x; ++x)
+					func(x,y,z, idx++, offsets, inside_faces(x,y,z, size));
+				continue;
+			}
+
+			// interior row, only the first and last voxel are at the border
+			func(0,y,z, idx++, offsets, ALL_FACES_INSIDE & ~1u);
+			for (int x=1; x<size.x-1; ++x)
+				func(x,y,z, idx++, offsets, AllFacesInside());
+			func(size.x-1,y,z, idx++, offsets, ALL_FACES_INSIDE & ~2u);
+		}
+	}
+};
+
+// BRICK^3 blocks stored contiguously (x-major inside a brick, bricks in x-major order), so neighbours are mostly in the same few cache lines
+// BRICK=4 with 1 byte voxels is one cache line per brick, BRICK=8 is 8 cache lines
+// size is padded to a multiple of BRICK
+template <int BRICK>
+struct BrickedLayout {
+	static_assert(BRICK > 0 && (BRICK & (BRICK-1)) == 0, "BrickedLayout: BRICK has to be a power of two");
+
+	static constexpr int	BRICK_SIZE = BRICK;
+	static constexpr int	MASK = BRICK-1;
+	static constexpr int	SHIFT = BRICK == 1 ? 0 : BRICK == 2 ? 1 : BRICK == 4 ? 2 : BRICK == 8 ? 3 : BRICK == 16 ? 4 : 5;
+	static constexpr size_t	VOLUME = (size_t)BRICK*BRICK*BRICK;
+	static_assert((1 << SHIFT) == BRICK, "BrickedLayout: BRICK too large");
+
+	int3	size = 0;
+	int3	bricks = 0; // brick count per axis
+
+	void init (int3 const& new_size) {
+		size = new_size;
+		bricks = (size + MASK) >> SHIFT;
+	}
+	size_t count () const {
+		return (size_t)bricks.x * bricks.y * bricks.z * VOLUME;
+	}
+
+	size_t brick_index (int bx, int by, int bz) const {
+		return (((size_t)bz * bricks.y + by) * bricks.x + bx) * VOLUME;
+	}
+	size_t index (int x, int y, int z) const {
+		return brick_index(x >> SHIFT, y >> SHIFT, z >> SHIFT) + (size_t)((((z & MASK) << SHIFT) + (y & MASK)) << SHIFT) + (x & MASK);
+	}
+	size_t neighbour (size_t idx, int x, int y, int z, int face) const {
+		// inside the brick the neighbour is a fixed offset away, only the brick border needs the full index
+		int local = face < 2 ? x & MASK : (face < 4 ? y & MASK : z & MASK);
+		size_t stride = face < 2 ? 1 : (face < 4 ? (size_t)BRICK : (size_t)BRICK*BRICK);
+		if (face & 1) {
+			if (local != MASK) return idx + stride;
+		} else {
+			if (local != 0) return idx - stride;
+		}
+		int d = face & 1 ? 1 : -1;
+		return index(x + (face < 2 ? d : 0), y + (face >= 2 && face < 4 ? d : 0), z + (face >= 4 ? d : 0));
+	}
+
+	template <typename FUNC>
+	void for_each (FUNC func) const {
+		bool padded = ((size.x | size.y | size.z) & MASK) != 0;
+		size_t idx = 0;
+		for (int bz=0; bz<bricks.z; ++bz)
+		for (int by=0; by<bricks.y; ++by)
+		for (int bx=0; bx<bricks.x; ++bx) {
+			for (int lz=0; lz<BRICK; ++lz)
+			for (int ly=0; ly<BRICK; ++ly)
+			for (int lx=0; lx<BRICK; ++lx) {
+				int x = (bx << SHIFT) + lx, y = (by << SHIFT) + ly, z = (bz << SHIFT) + lz;
+				if (!padded || (x < size.x && y < size.y && z < size.z))
+					func(x,y,z, idx);
+				idx++;
+			}
+		}
+	}
+	template <typename FUNC>
+	void for_each_neighbours (FUNC func) const {
+		// crossing a brick border steps to the neighbouring brick and wraps the local coordinate
+		ptrdiff_t brick_x = (ptrdiff_t)VOLUME;
+		ptrdiff_t brick_y = brick_x * bricks.x;
+		ptrdiff_t brick_z = brick_y * bricks.y;
+
+		size_t idx = 0;
+		for (int bz=0; bz<bricks.z; ++bz)
+		for (int by=0; by<bricks.y; ++by)
+		for (int bx=0; bx<bricks.x; ++bx) {
+			// all neighbour bricks exist, so the brick is not padded and no voxel in it is at the border
+			bool interior = bx > 0 && by > 0 && bz > 0 && bx < bricks.x-1 && by < bricks.y-1 && bz < bricks.z-1;
+			if (interior)
+				_brick_neighbours<true>(bx,by,bz, idx, brick_x, brick_y, brick_z, func);
+			else
+				_brick_neighbours<false>(bx,by,bz, idx, brick_x, brick_y, brick_z, func);
+			idx += VOLUME;
+		}
+	}
+	template <bool INTERIOR, typename FUNC>
+	void _brick_neighbours (int bx, int by, int bz, size_t idx, ptrdiff_t brick_x, ptrdiff_t brick_y, ptrdiff_t brick_z, FUNC& func) const {
+		constexpr ptrdiff_t WRAP_X = MASK, WRAP_Y = (ptrdiff_t)MASK * BRICK, WRAP_Z = (ptrdiff_t)MASK * BRICK*BRICK;
+
+		ptrdiff_t offsets[6];
+		for (int lz=0; lz<BRICK; ++lz) {
+			offsets[4] = lz > 0     ? -BRICK*BRICK : WRAP_Z - brick_z;
+			offsets[5] = lz < MASK  ?  BRICK*BRICK : brick_z - WRAP_Z;
+			for (int ly=0; ly<BRICK; ++ly) {
+				offsets[2] = ly > 0    ? -BRICK : WRAP_Y - brick_y;
+				offsets[3] = ly < MASK ?  BRICK : brick_y - WRAP_Y;
+				for (int lx=0; lx<BRICK; ++lx) {
+					offsets[0] = lx > 0    ? -1 : WRAP_X - brick_x;
+					offsets[1] = lx < MASK ?  1 : brick_x - WRAP_X;
+
+					int x = (bx << SHIFT) + lx, y = (by << SHIFT) + ly, z = (bz << SHIFT) + lz;
+					if constexpr (INTERIOR) {
+						func(x,y,z, idx, offsets, AllFacesInside());
+					}
+					else {
+						if (x < size.x && y < size.y && z < size.z)
+							func(x,y,z, idx, offsets, inside_faces(x,y,z, size));
+					}
+					idx++;
+				}
+			}
+		}
+	}
+};
+
+// neighbour offsets inside a 4^3 block of MortonLayout (which are 64 contiguous elements)
+struct MortonBlockTables {
+	uint8_t		pos[64][3];
+	ptrdiff_t	offset[64][6]; // index offset to the neighbour, neighbours in the next block wrap around as if it directly followed
+	uint8_t		crosses[64]; // bit face set if the neighbour is in the neighbouring block
+};
+inline constexpr MortonBlockTables _make_morton_block_tables () {
+	MortonBlockTables t = {};
+	for (uint32_t l=0; l<64; ++l) {
+		uint32_t p[3];
+		morton3_decode(l, &p[0], &p[1], &p[2]);
+		for (int a=0; a<3; ++a)
+			t.pos[l][a] = (uint8_t)p[a];
+
+		for (int face=0; face<6; ++face) {
+			uint32_t n[3] = { p[0], p[1], p[2] };
+			int axis = face >> 1;
+			bool crosses = face & 1 ? n[axis] == 3 : n[axis] == 0;
+			n[axis] = (n[axis] + (face & 1 ? 1 : 3)) & 3;
+
+			t.offset[l][face] = (ptrdiff_t)morton3_encode(n[0], n[1], n[2]) - (ptrdiff_t)l;
+			if (crosses)
+				t.crosses[l] |= (uint8_t)(1 << face);
+		}
+	}
+	return t;
+}
+inline constexpr MortonBlockTables MORTON_BLOCK_TABLES = _make_morton_block_tables();
+
+// Z-order curve over the whole array, neighbours in all directions are close on average and any power of two sized cube is contiguous
+// size is padded to a power of two cube of the largest axis, so only use for (roughly) cubic arrays
+struct MortonLayout {
+	int3	size = 0;
+	int		dim = 0; // padded power of two size
+
+	void init (int3 const& new_size) {
+		size = new_size;
+		dim = (int)upper_power_of_two((uint64_t)max(max(size.x, size.y), size.z));
+		assert(dim <= (1 << 21));
+	}
+	size_t count () const {
+		return (size_t)dim * dim * dim;
+	}
+
+	size_t index (int x, int y, int z) const {
+		return (size_t)morton3_encode((uint32_t)x, (uint32_t)y, (uint32_t)z);
+	}
+	size_t neighbour (size_t idx, int x, int y, int z, int face) const {
+		uint64_t mask = face < 2 ? MORTON3_X : (face < 4 ? MORTON3_Y : MORTON3_Z);
+		return (size_t)(face & 1 ? morton3_inc(idx, mask) : morton3_dec(idx, mask));
+	}
+
+	template <typename FUNC>
+	void for_each (FUNC func) const {
+		size_t n = count();
+		for (size_t idx=0; idx<n; ++idx) {
+			uint32_t x, y, z;
+			morton3_decode(idx, &x, &y, &z);
+			if ((int)x < size.x && (int)y < size.y && (int)z < size.z)
+				func((int)x, (int)y, (int)z, idx);
+		}
+	}
+	// offsets of MortonLayout::for_each_neighbours, table lookup plus the offset to the neighbouring block for faces that cross into it
+	struct BlockOffsets {
+		ptrdiff_t const*	offset;
+		ptrdiff_t const*	block;
+		uint32_t			crosses;
+
+		ptrdiff_t operator[] (int face) const {
+			return offset[face] + (block[face] & -(ptrdiff_t)((crosses >> face) & 1));
+		}
+	};
+
+	template <typename FUNC>
+	void for_each_neighbours (FUNC func) const {
+		auto& t = MORTON_BLOCK_TABLES;
+		// idx >> 6 is the morton index of the block, arrays smaller than a block only use the start of block 0
+		size_t blocks = (count() + 63) >> 6;
+		for (size_t b=0; b<blocks; ++b) {
+			uint32_t bx, by, bz;
+			morton3_decode(b, &bx, &by, &bz);
+			int x0 = (int)bx << 2, y0 = (int)by << 2, z0 = (int)bz << 2;
+			if (x0 >= size.x || y0 >= size.y || z0 >= size.z)
+				continue; // only padding
+
+			// offset to the start of each neighbouring block, only used where that block is inside
+			ptrdiff_t block[6] = {};
+			uint64_t masks[3] = { MORTON3_X, MORTON3_Y, MORTON3_Z };
+			uint32_t bpos[3] = { bx, by, bz };
+			for (int axis=0; axis<3; ++axis) {
+				if (bpos[axis] > 0)
+					block[axis*2  ] = ((ptrdiff_t)morton3_dec(b, masks[axis]) - (ptrdiff_t)b) << 6;
+				if ((int)bpos[axis] < (dim >> 2) - 1)
+					block[axis*2+1] = ((ptrdiff_t)morton3_inc(b, masks[axis]) - (ptrdiff_t)b) << 6;
+			}
+
+			size_t base = b << 6;
+			bool interior = x0 > 0 && y0 > 0 && z0 > 0 && x0+4 < size.x && y0+4 < size.y && z0+4 < size.z;
+			if (interior) {
+				for (int l=0; l<64; ++l) {
+					BlockOffsets offsets = { t.offset[l], block, t.crosses[l] };
+					func(x0 + t.pos[l][0], y0 + t.pos[l][1], z0 + t.pos[l][2], base + l, offsets, AllFacesInside());
+				}
+			}
+			else {
+				for (int l=0; l<64; ++l) {
+					int x = x0 + t.pos[l][0], y = y0 + t.pos[l][1], z = z0 + t.pos[l][2];
+					if (x < size.x && y < size.y && z < size.z) {
+						BlockOffsets offsets = { t.offset[l], block, t.crosses[l] };
+						func(x,y,z, base + l, offsets, inside_faces(x,y,z, size));
+					}
+				}
+			}
+		}
+	}
+};
+
+// 3d array of POD data, LAYOUT decides the memory order (see FlatLayout, BrickedLayout, MortonLayout)
+// for_each and for_each_neighbours iterate in storage order, for BrickedLayout and MortonLayout that beats xyz loops with get(), for FlatLayout it's about the same
+//  (see kisslib/bench/bench_array3D_layouts.cpp), but only with n.for_each_face, a loop over n[face] does usually not get unrolled and ends up slower than get()
+// neighbours(pos) is for single positions, like looking around an edited voxel
+/* pattern:
+	array3D<uint8_t, BrickedLayout<4>> voxels (int3(64));
+
+	voxels.for_each_neighbours([&] (int3 pos, uint8_t& val, auto const& n) {
+		if (!val) return;
+		n.for_each_face([&] (int face, uint8_t* neighbour) {
+			if (!neighbour || !*neighbour) emit_face(pos, face);
+		});
+	});
+*/
+template <typename T, typename LAYOUT = FlatLayout>
 struct array3D {
 	MOVE_ONLY_CLASS(array3D)
 public:
 
 	T*		data = nullptr;
 	int3	size = 0;
+	LAYOUT	layout;
+
+	// face neighbours of one position, nullptr where the neighbour is outside of the array
+	struct Neighbours {
+		T*	ptrs[6]; // -X +X -Y +Y -Z +Z
+
+		T* operator[] (int face) const {
+			return ptrs[face];
+		}
+	};
 
 	friend void swap (array3D& l, array3D& r) {
 		std::swap(l.data, r.data);
 		std::swap(l.size, r.size);
+		std::swap(l.layout, r.layout);
 	}
 
 	array3D () {}
@@ -28,12 +358,14 @@ public:
 
 	void resize (int3 new_size) {
 		size = new_size;
+		layout.init(size);
 		if (data) ::free(data);
-		data = (T*)malloc(sizeof(T) * size.x * size.y * size.z);
+		data = (T*)malloc(sizeof(T) * layout.count());
 	}
 
-	size_t count () {
-		return size.z * size.y * size.x;
+	// allocated elements, data[0, count()) is valid, includes the padding of non-flat layouts
+	size_t count () const {
+		return layout.count();
 	}
 
 	void clear (T const& val) {
@@ -48,11 +380,11 @@ public:
 		}
 	}
 
-	size_t index (int x, int y, int z) {
+	size_t index (int x, int y, int z) const {
 		assert( (unsigned)x < (unsigned)size.x &&
 			(unsigned)y < (unsigned)size.y &&
 			(unsigned)z < (unsigned)size.z );
-		return (z * size.y + y) * size.x + x;
+		return layout.index(x,y,z);
 	}
 
 	T const& get (int x, int y, int z) const {
@@ -74,6 +406,104 @@ public:
 	T& operator[] (int3 const& pos) {
 		return get(pos.x, pos.y, pos.z);
 	}
+
+	Neighbours _neighbours (int x, int y, int z, size_t idx) {
+		Neighbours n;
+		n.ptrs[0] = x > 0        ? &data[layout.neighbour(idx, x,y,z, 0)] : nullptr;
+		n.ptrs[1] = x < size.x-1 ? &data[layout.neighbour(idx, x,y,z, 1)] : nullptr;
+		n.ptrs[2] = y > 0        ? &data[layout.neighbour(idx, x,y,z, 2)] : nullptr;
+		n.ptrs[3] = y < size.y-1 ? &data[layout.neighbour(idx, x,y,z, 3)] : nullptr;
+		n.ptrs[4] = z > 0        ? &data[layout.neighbour(idx, x,y,z, 4)] : nullptr;
+		n.ptrs[5] = z < size.z-1 ? &data[layout.neighbour(idx, x,y,z, 5)] : nullptr;
+		return n;
+	}
+	Neighbours neighbours (int3 const& pos) {
+		return _neighbours(pos.x, pos.y, pos.z, index(pos.x, pos.y, pos.z));
+	}
+
+	// template callback 'void func (int3 pos, T& val)' for all positions in storage order
+	template <typename FUNC>
+	void for_each (FUNC func) {
+		layout.for_each([&] (int x, int y, int z, size_t idx) {
+			func(int3(x,y,z), data[idx]);
+		});
+	}
+	// face neighbours passed by for_each_neighbours, n[face] is nullptr where the neighbour is outside of the array
+	// pointers are only computed for the faces that are looked at, so skipping empty voxels early costs nothing
+	template <typename OFFSETS, typename INSIDE>
+	struct NeighbourView {
+		T*				ptr;
+		OFFSETS const&	offsets;
+		INSIDE			inside;
+
+		T* operator[] (int face) const {
+			return inside & (1u << face) ? ptr + offsets[face] : nullptr;
+		}
+		// func(int face, T* neighbour) for all 6 faces, unrolled so that face and the inside checks are constants
+		template <typename FUNC>
+		_FORCEINLINE void for_each_face (FUNC func) const {
+			func(0, (*this)[0]); func(1, (*this)[1]);
+			func(2, (*this)[2]); func(3, (*this)[3]);
+			func(4, (*this)[4]); func(5, (*this)[5]);
+		}
+	};
+
+	// template callback 'void func (int3 pos, T& val, auto const& n)' for all positions in storage order, n like Neighbours
+	template <typename FUNC>
+	void for_each_neighbours (FUNC func) {
+		layout.for_each_neighbours([&] (int x, int y, int z, size_t idx, auto const& offsets, auto inside) {
+			T* ptr = &data[idx];
+			NeighbourView<std::remove_cvref_t<decltype(offsets)>, decltype(inside)> n = { ptr, offsets, inside };
+			func(int3(x,y,z), *ptr, n);
+		});
+	}
+
+	// BrickedLayout only: pointer to the BRICK^3 contiguous elements of a brick
+	T* brick (int3 const& brick_pos) {
+		assert(all(brick_pos >= 0 && brick_pos < layout.bricks));
+		return &data[layout.brick_index(brick_pos.x, brick_pos.y, brick_pos.z)];
+	}
+
+	// copy the box [src_pos, src_pos+region) of src to [dst_pos, dst_pos+region) of this
+	// whole bricks are memcpy'd if both arrays use the same BrickedLayout and the box is brick aligned, flat rows are memcpy'd if both are flat
+	template <typename SRC_LAYOUT>
+	void copy_region (array3D<T, SRC_LAYOUT> const& src, int3 const& src_pos, int3 const& dst_pos, int3 const& region) {
+		static_assert(std::is_trivially_copyable_v<T>, "array3D::copy_region: T has to be trivially copyable");
+		assert(all(src_pos >= 0 && src_pos + region <= src.size));
+		assert(all(dst_pos >= 0 && dst_pos + region <= size));
+
+		if constexpr (std::is_same_v<SRC_LAYOUT, LAYOUT> && !std::is_same_v<LAYOUT, FlatLayout> && !std::is_same_v<LAYOUT, MortonLayout>) {
+			constexpr int B = LAYOUT::BRICK_SIZE;
+			bool aligned = ((src_pos.x | src_pos.y | src_pos.z | dst_pos.x | dst_pos.y | dst_pos.z) & (B-1)) == 0;
+			// partial bricks at the end are fine if they are the padded bricks at the end of both arrays
+			int3 end = region + dst_pos, src_end = region + src_pos;
+			bool whole = all(equal(region & (B-1), 0) || (equal(end, size) && equal(src_end, src.size)));
+			if (aligned && whole) {
+				int3 count = (region + (B-1)) / B;
+				for (int z=0; z<count.z; ++z)
+				for (int y=0; y<count.y; ++y)
+				for (int x=0; x<count.x; ++x) {
+					int3 b = int3(x,y,z);
+					memcpy(brick(dst_pos / B + b), src.layout.brick_index(src_pos.x / B + x, src_pos.y / B + y, src_pos.z / B + z) + src.data,
+						sizeof(T) * LAYOUT::VOLUME);
+				}
+				return;
+			}
+		}
+		else if constexpr (std::is_same_v<SRC_LAYOUT, FlatLayout> && std::is_same_v<LAYOUT, FlatLayout>) {
+			for (int z=0; z<region.z; ++z)
+			for (int y=0; y<region.y; ++y) {
+				memcpy(&get(dst_pos.x, dst_pos.y + y, dst_pos.z + z), &src.get(src_pos.x, src_pos.y + y, src_pos.z + z), sizeof(T) * region.x);
+			}
+			return;
+		}
+
+		for (int z=0; z<region.z; ++z)
+		for (int y=0; y<region.y; ++y)
+		for (int x=0; x<region.x; ++x) {
+			get(dst_pos.x + x, dst_pos.y + y, dst_pos.z + z) = src.get(src_pos.x + x, src_pos.y + y, src_pos.z + z);
+		}
+	}
 };
 
 
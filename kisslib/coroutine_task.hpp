@@ -0,0 +1,218 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <vector>
+#include <atomic>
+#include <string>
+#include "assert.h"
+#include "threadsafe_queue.hpp"
+#include "task_group.hpp"
+#include "file_io.hpp"
+
+// C++20 coroutines on top of Threadpool and the main loop
+// allows loading code to be written linearly instead of as job structs that get polled for results
+/* pattern:
+	kissPoolTask<void> load_texture (Threadpool<Job>& pool, std::string filename) {
+		auto file = co_await kiss::load_file_async(pool, filename); // read on a pool thread
+
+		Image img = decode_png(file.data.get(), file.size);          // still on the pool thread
+
+		co_await kiss::next_frame();                                   // back on the main thread in window_frame
+		upload_texture(img);
+	}
+
+	load_texture(pool, "textures/grass.png").detach();
+*/
+// Tasks are lazy, they only start running once they are co_await'ed or detach()'ed
+// a coroutine runs on whatever thread resumed it, so after co_await resume_on(pool) it is on a pool thread until it awaits something else
+namespace kiss {
+	template <typename T=void> class Task;
+
+	namespace _coro {
+		// resumes the awaiting coroutine (if any) when the task finishes, destroys detached tasks
+		struct FinalAwaiter {
+			bool await_ready () noexcept { return false; }
+
+			template <typename PROMISE>
+			std::coroutine_handle<> await_suspend (std::coroutine_handle<PROMISE> h) noexcept {
+				auto& p = h.promise();
+				auto continuation = p.continuation;
+
+				if (p.detached) {
+					h.destroy();
+				}
+
+				if (continuation)
+					return continuation;
+				return std::noop_coroutine();
+			}
+			void await_resume () noexcept {}
+		};
+
+		struct PromiseBase {
+			std::coroutine_handle<>	continuation = nullptr;
+			bool					detached = false;
+
+			std::suspend_always initial_suspend () noexcept { return {}; }
+			FinalAwaiter final_suspend () noexcept { return {}; }
+
+			// no exceptions in this codebase
+			void unhandled_exception () { std::terminate(); }
+		};
+
+		template <typename T>
+		struct Promise : PromiseBase {
+			std::optional<T> value;
+
+			Task<T> get_return_object ();
+			void return_value (T val) { value = std::move(val); }
+		};
+		template <>
+		struct Promise<void> : PromiseBase {
+			Task<void> get_return_object ();
+			void return_void () {}
+		};
+	}
+
+	template <typename T>
+	class Task {
+	public:
+		using promise_type = _coro::Promise<T>;
+
+	private:
+		std::coroutine_handle<promise_type> h = nullptr;
+
+	public:
+		Task () {}
+		explicit Task (std::coroutine_handle<promise_type> h): h{h} {}
+
+		Task (Task const&) = delete;
+		Task& operator= (Task const&) = delete;
+		Task (Task&& r): h{r.h} { r.h = nullptr; }
+		Task& operator= (Task&& r) {
+			if (this != &r) {
+				if (h) h.destroy();
+				h = r.h;
+				r.h = nullptr;
+			}
+			return *this;
+		}
+
+		~Task () {
+			if (h) h.destroy();
+		}
+
+		bool valid () const { return h != nullptr; }
+
+		// start running the task and let it free itself once done, result is discarded
+		void detach () {
+			assert(h);
+			auto handle = h;
+			h = nullptr;
+			handle.promise().detached = true;
+			handle.resume();
+		}
+
+		// co_await task starts it and resumes the awaiting coroutine (on the thread the task finishes on) with it's result
+		auto operator co_await () && noexcept {
+			struct Awaiter {
+				std::coroutine_handle<promise_type> h;
+
+				bool await_ready () noexcept { return false; }
+				std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaiting) noexcept {
+					h.promise().continuation = awaiting;
+					return h; // symmetric transfer, no stack growth for chains of tasks
+				}
+				T await_resume () {
+					if constexpr (!std::is_void_v<T>)
+						return std::move(*h.promise().value);
+				}
+			};
+			assert(h);
+			return Awaiter{ h };
+		}
+	};
+
+	template <typename T>
+	Task<T> _coro::Promise<T>::get_return_object () {
+		return Task<T>( std::coroutine_handle<Promise<T>>::from_promise(*this) );
+	}
+	inline Task<void> _coro::Promise<void>::get_return_object () {
+		return Task<void>( std::coroutine_handle<Promise<void>>::from_promise(*this) );
+	}
+
+	// co_await resume_on(threadpool) continues the coroutine on a thread of the pool
+	// uses the pools resumes queue, so it needs no job allocation
+	// unlike the pools tasks, resumes are never run by threads helping out in TaskGroup::wait or contribute_work,
+	// so the coroutine never continues on the main thread or inline on the current thread (the pool needs at least one thread)
+	template <typename POOL>
+	struct ResumeOnAwaiter {
+		POOL& pool;
+
+		bool await_ready () noexcept { return false; }
+		void await_suspend (std::coroutine_handle<> h) {
+			static_assert(sizeof(std::coroutine_handle<>) <= PoolTask::STORAGE_SIZE);
+
+			PoolTask task;
+			task.invoke = [] (PoolTask& task) {
+				(*(std::coroutine_handle<>*)task.storage).resume();
+			};
+			new (task.storage) std::coroutine_handle<>(h);
+
+			pool.push_resume(task); // might already be running on another thread once this returns
+		}
+		void await_resume () noexcept {}
+	};
+	template <typename POOL>
+	inline ResumeOnAwaiter<POOL> resume_on (POOL& pool) {
+		return { pool };
+	}
+
+	// coroutines waiting for the main thread, resumed once per frame by resume_main_thread_coroutines() in window_frame
+	inline ThreadsafeQueue<std::coroutine_handle<>> _main_thread_coroutines;
+
+	// co_await next_frame() continues the coroutine on the main thread at the start of the next frame
+	// can be awaited from any thread (including the main thread to simply wait a frame)
+	struct NextFrameAwaiter {
+		bool await_ready () noexcept { return false; }
+		void await_suspend (std::coroutine_handle<> h) {
+			_main_thread_coroutines.push(h);
+		}
+		void await_resume () noexcept {}
+	};
+	inline NextFrameAwaiter next_frame () {
+		return {};
+	}
+
+	// called once per frame on the main thread
+	// coroutines that await next_frame() again while being resumed run next frame, not in this loop
+	inline void resume_main_thread_coroutines () {
+		ZoneScoped;
+
+		static std::vector<std::coroutine_handle<>> handles; // keep capacity
+		handles.clear();
+		_main_thread_coroutines.pop_all(&handles);
+
+		for (auto& h : handles)
+			h.resume();
+	}
+
+	struct FileData {
+		raw_data	data;
+		uint64_t	size = 0;
+
+		explicit operator bool () const { return data != nullptr; }
+	};
+
+	// read an entire file on a thread of the pool, the coroutine stays on that thread afterwards
+	// returns empty FileData on fail
+	template <typename POOL>
+	Task<FileData> load_file_async (POOL& pool, std::string filename) {
+		co_await resume_on(pool);
+
+		FileData file;
+		file.data = load_binary_file(filename.c_str(), &file.size);
+		co_return file;
+	}
+}
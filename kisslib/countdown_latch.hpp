@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+
+// counter that a thread can wait on to reach zero, waking it exactly once instead of on every count_down
+// unlike std::latch it can be reused (add() after it reached zero)
+/* pattern:
+	CountdownLatch latch;
+	latch.add((int)chunks.size());
+	for (auto& c : chunks)
+		threadpool.jobs.push(std::make_unique<Job>(c, &latch));
+	
+	latch.wait(); // all jobs done and their results pushed
+	threadpool.results.pop_all(&results);
+*/
+class CountdownLatch {
+	NO_MOVE_COPY_CLASS(CountdownLatch)
+
+	std::atomic<int> count;
+
+public:
+	CountdownLatch (int count=0): count{count} {}
+
+	// register more work, call before the work can count down
+	void add (int n=1) {
+		count.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	// only the count_down that reaches zero wakes waiters
+	void count_down (int n=1) {
+		int prev = count.fetch_sub(n, std::memory_order_acq_rel);
+		assert(prev >= n);
+		if (prev == n)
+			count.notify_all();
+	}
+
+	// only a snapshot when used concurrently
+	int pending () const {
+		return count.load(std::memory_order_acquire);
+	}
+	bool is_done () const {
+		return pending() <= 0;
+	}
+
+	// wait until the count reaches zero
+	void wait () {
+		for (;;) {
+			int c = count.load(std::memory_order_acquire);
+			if (c <= 0)
+				return;
+			count.wait(c, std::memory_order_acquire); // returns once count changed
+		}
+	}
+};
@@ -0,0 +1,285 @@
+#include "memory_snapshot.hpp"
+#include "timer.hpp"
+#include <thread>
+
+static std::atomic<MemorySnapshot*> _active_snapshot = nullptr;
+
+// fault handlers currently inside _on_fault, end() waits for them before freeing the shadow copies
+static std::atomic<int>		_handlers_running = 0;
+// set by end(), cleared by the next begin(), so real access violations are only retried around the end of a snapshot
+static std::atomic<bool>	_snapshot_ended = false;
+static thread_local void*	_last_retry_addr = nullptr;
+
+// implemented per platform below
+static void install_fault_handler ();
+static void protect_pages (void* ptr, size_t size, bool writable);
+
+// called by the platform fault handler for write faults, returns true if the access should be retried
+static bool _on_fault (void* addr) {
+	_handlers_running.fetch_add(1);
+
+	bool handled = false;
+	if (auto* snap = _active_snapshot.load())
+		handled = snap->_handle_write_fault(addr);
+
+	_handlers_running.fetch_sub(1);
+
+	if (handled) {
+		_last_retry_addr = nullptr;
+		return true;
+	}
+	// the thread might have faulted just before end() unprotected the page and only got here after end() returned,
+	// (or after the next begin() already started) retry the access once, if it faults again it's a real access violation
+	if ((_snapshot_ended.load() || _active_snapshot.load()) && addr != _last_retry_addr) {
+		_last_retry_addr = addr;
+		return true;
+	}
+	return false;
+}
+
+static void _wait () {
+	std::this_thread::yield(); // the thread we wait for might be on the same core
+}
+
+void MemorySnapshot::begin (bool copy_on_write) {
+	assert(!active);
+	auto timer = kiss::Timer::start();
+
+	install_fault_handler();
+
+	this->copy_on_write = copy_on_write;
+	size_t page_size = os_page_size;
+
+	for (auto& reg : regions) {
+		reg.page_count = (reg.size + page_size-1) / page_size;
+		reg.pages = std::make_unique<std::atomic<uint8_t>[]>(reg.page_count); // PAGE_UNTOUCHED
+
+		if (copy_on_write && reg.page_count > 0) {
+			// only pages that actually get copied use memory
+			reg.shadow = (char*)reserve_address_space(reg.page_count * page_size);
+			commit_pages(reg.shadow, reg.page_count * page_size);
+		}
+	}
+
+	MemorySnapshot* expected = nullptr;
+	bool ok = _active_snapshot.compare_exchange_strong(expected, this);
+	assert(ok); // only one snapshot can be active at a time
+	(void)ok;
+	_snapshot_ended = false; // after setting _active_snapshot, so late faults from the last snapshot are still retried
+
+	_decommit_hook = [] (void* ptr, size_t size) {
+		if (auto* snap = _active_snapshot.load())
+			snap->_before_decommit(ptr, size);
+	};
+	active = true;
+
+	for (auto& reg : regions) {
+		if (reg.page_count > 0)
+			protect_pages(reg.base, reg.page_count * page_size, false);
+	}
+
+	last_pause_sec = timer.end();
+}
+
+void MemorySnapshot::end () {
+	assert(active);
+	size_t page_size = os_page_size;
+
+	// unprotect runs of pages that are still committed
+	for (auto& reg : regions) {
+		size_t i = 0;
+		while (i < reg.page_count) {
+			if (reg.pages[i].load() & PAGE_DECOMMITTED) {
+				i++;
+				continue;
+			}
+			size_t begin = i;
+			while (i < reg.page_count && !(reg.pages[i].load() & PAGE_DECOMMITTED))
+				i++;
+			protect_pages(reg.base + begin * page_size, (i - begin) * page_size, true);
+		}
+	}
+
+	_snapshot_ended = true;
+	_decommit_hook = nullptr;
+	_active_snapshot = nullptr;
+
+	while (_handlers_running.load() != 0)
+		_wait();
+
+	for (auto& reg : regions) {
+		if (reg.shadow)
+			release_address_space(reg.shadow, reg.page_count * page_size);
+		reg.shadow = nullptr;
+	}
+
+	active = false;
+}
+
+bool MemorySnapshot::_begin_read_page (Region& reg, size_t page) {
+	auto& st = reg.pages[page];
+	for (;;) {
+		uint8_t s = st.load(std::memory_order_acquire);
+		switch (s & PAGE_STATE_MASK) {
+			case PAGE_UNTOUCHED: {
+				// writers that fault now wait until _end_read_page
+				if (st.compare_exchange_weak(s, (uint8_t)(s | PAGE_READING), std::memory_order_acquire))
+					return true;
+			} break;
+
+			case PAGE_COPYING: {
+				_wait();
+			} break;
+
+			default: {
+				assert((s & PAGE_STATE_MASK) == PAGE_SAVED);
+				return false;
+			}
+		}
+	}
+}
+void MemorySnapshot::_end_read_page (Region& reg, size_t page) {
+	reg.pages[page].fetch_xor(PAGE_READING ^ PAGE_READ, std::memory_order_release);
+}
+
+// bring the page into a state where the live memory can change, copying it to shadow if needed
+// returns false if it was decommitted
+static bool _save_page (MemorySnapshot::Region& reg, size_t page, bool copy_on_write, uint8_t flags) {
+	size_t page_size = os_page_size;
+	auto& st = reg.pages[page];
+	for (;;) {
+		uint8_t s = st.load(std::memory_order_acquire);
+		if (s & MemorySnapshot::PAGE_DECOMMITTED)
+			return false;
+
+		switch (s & MemorySnapshot::PAGE_STATE_MASK) {
+			case MemorySnapshot::PAGE_UNTOUCHED: {
+				if (!copy_on_write) {
+					if (st.compare_exchange_weak(s, (uint8_t)(s | MemorySnapshot::PAGE_READ | flags)))
+						return true;
+				}
+				else if (st.compare_exchange_weak(s, (uint8_t)(s | MemorySnapshot::PAGE_COPYING | flags), std::memory_order_acquire)) {
+					memcpy(reg.shadow + page * page_size, reg.base + page * page_size, page_size);
+					st.fetch_xor(MemorySnapshot::PAGE_COPYING ^ MemorySnapshot::PAGE_SAVED, std::memory_order_release);
+					return true;
+				}
+			} break;
+
+			case MemorySnapshot::PAGE_COPYING:
+			case MemorySnapshot::PAGE_READING: {
+				_wait();
+			} break;
+
+			default: {
+				st.fetch_or(flags);
+				return true;
+			}
+		}
+	}
+}
+
+bool MemorySnapshot::_handle_write_fault (void* addr) {
+	size_t page_size = os_page_size;
+	for (auto& reg : regions) {
+		if ((char*)addr < reg.base || (char*)addr >= reg.base + reg.page_count * page_size)
+			continue;
+
+		size_t page = ((char*)addr - reg.base) / page_size;
+		if (!_save_page(reg, page, copy_on_write, PAGE_DIRTY))
+			return false;
+
+		// multiple threads can end up unprotecting the same page, which is harmless
+		protect_pages(reg.base + page * page_size, page_size, true);
+		return true;
+	}
+	return false;
+}
+
+void MemorySnapshot::_before_decommit (void* ptr, size_t size) {
+	size_t page_size = os_page_size;
+	for (auto& reg : regions) {
+		char* begin = std::max((char*)ptr, reg.base);
+		char* end = std::min((char*)ptr + size, reg.base + reg.page_count * page_size);
+		if (begin >= end)
+			continue;
+
+		for (size_t page = (begin - reg.base) / page_size; page < (size_t)(end - reg.base + page_size-1) / page_size; ++page) {
+			// recommitted pages will be zero, so they count as written
+			_save_page(reg, page, copy_on_write, PAGE_DIRTY);
+			reg.pages[page].fetch_or(PAGE_DECOMMITTED);
+		}
+	}
+}
+
+////// Platform specific code
+
+#ifdef _WIN32
+#include "clean_windows_h.hpp"
+
+static LONG CALLBACK vectored_exception_handler (EXCEPTION_POINTERS* info) {
+	auto* rec = info->ExceptionRecord;
+	// ExceptionInformation[0] == 1 -> write access
+	if (rec->ExceptionCode == EXCEPTION_ACCESS_VIOLATION && rec->NumberParameters >= 2 && rec->ExceptionInformation[0] == 1) {
+		if (_on_fault((void*)rec->ExceptionInformation[1]))
+			return EXCEPTION_CONTINUE_EXECUTION;
+	}
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+static void install_fault_handler () {
+	static bool installed = false;
+	if (installed) return;
+
+	AddVectoredExceptionHandler(1, vectored_exception_handler);
+	installed = true;
+}
+
+static void protect_pages (void* ptr, size_t size, bool writable) {
+	DWORD old;
+	auto ret = VirtualProtect(ptr, size, writable ? PAGE_READWRITE : PAGE_READONLY, &old);
+	assert(ret != 0);
+}
+
+#elif defined(__linux__)
+#include <signal.h>
+#include <sys/mman.h>
+
+static struct sigaction _old_sigsegv;
+
+static void sigsegv_handler (int sig, siginfo_t* info, void* ctx) {
+	if (_on_fault(info->si_addr))
+		return;
+
+	// not ours, pass on to the previous handler
+	if (_old_sigsegv.sa_flags & SA_SIGINFO) {
+		if (_old_sigsegv.sa_sigaction) {
+			_old_sigsegv.sa_sigaction(sig, info, ctx);
+			return;
+		}
+	}
+	else if (_old_sigsegv.sa_handler != SIG_DFL && _old_sigsegv.sa_handler != SIG_IGN) {
+		_old_sigsegv.sa_handler(sig);
+		return;
+	}
+	// returning re-executes the access, which now crashes as usual
+	signal(sig, SIG_DFL);
+}
+
+static void install_fault_handler () {
+	static bool installed = false;
+	if (installed) return;
+
+	struct sigaction sa = {};
+	sa.sa_sigaction = sigsegv_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &_old_sigsegv);
+	installed = true;
+}
+
+static void protect_pages (void* ptr, size_t size, bool writable) {
+	auto ret = mprotect(ptr, size, writable ? PROT_READ|PROT_WRITE : PROT_READ);
+	assert(ret == 0);
+}
+
+#endif
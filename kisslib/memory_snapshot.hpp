@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+#include "allocator.hpp"
+
+// Point-in-time copy of allocator memory without stopping the world while it is saved
+// begin() write-protects the committed pages of all regions, which is the only pause for the main thread
+// the first write to a page afterwards faults, the fault handler copies the page into a shadow buffer and unprotects it,
+// so a worker thread can stream the state as of begin() via read_pages() while the simulation keeps writing to the live memory
+/* pattern:
+	MemorySnapshot snap;
+	snap.add_region(chunk_voxels); // BlockAllocator or VirtualPushAllocator
+	snap.add_region(entities);
+	snap.begin(); // main thread, microseconds
+
+	threadpool.jobs.push(std::make_unique<SaveJob>(&snap)); // SaveJob::execute: snap.read_pages([&] (int region, size_t offset, void const* data, size_t size) { write(...) });
+
+	... once the job is done (main thread):
+	snap.end();
+*/
+// pages written since begin() are marked dirty (also after end(), until the next begin()), which allows incremental saves
+//  with copy_on_write=false begin() only tracks dirty pages and read_pages() is not available
+// memory committed after begin() is not part of the snapshot, pages decommitted during the snapshot are saved before being dropped
+// only one snapshot can be active at a time, pages are os_page_size even for large_pages allocators (which splits their 2MB pages)
+// kernel writes into regions do not fault into the handler, so during a snapshot read()/fread()/recv() etc. directly into region memory
+//  fail with EFAULT (ERROR_NOACCESS on windows) for pages that were not written yet, read into a temporary buffer and memcpy instead
+class MemorySnapshot {
+	NO_MOVE_COPY_CLASS(MemorySnapshot)
+public:
+	enum PageState : uint8_t {
+		PAGE_UNTOUCHED	= 0, // still write-protected, live memory is the snapshot
+		PAGE_COPYING	= 1, // fault handler is copying it to shadow
+		PAGE_SAVED		= 2, // shadow holds the snapshot
+		PAGE_READING	= 3, // read_pages is reading the live memory, writers wait
+		PAGE_READ		= 4, // read_pages is done with it
+		PAGE_STATE_MASK	= 7,
+
+		PAGE_DECOMMITTED= 0x40,
+		PAGE_DIRTY		= 0x80,
+	};
+
+	struct Region {
+		char*	base;
+		size_t	size; // committed size at begin()
+
+		char*	shadow = nullptr; // snapshot copies of pages written during the snapshot
+		std::unique_ptr<std::atomic<uint8_t>[]> pages; // PageState
+		size_t	page_count = 0;
+	};
+
+	std::vector<Region>	regions;
+	bool				copy_on_write = true;
+	bool				active = false;
+
+	float				last_pause_sec = 0; // time begin() took
+
+	MemorySnapshot () {}
+	~MemorySnapshot () {
+		if (active) end();
+	}
+
+	// register memory to be part of the snapshot, only the committed part at the time of begin() is included
+	void add_region (void* base, size_t size) {
+		assert(!active);
+		regions.push_back({ (char*)base, size });
+	}
+	template <typename T>
+	void add_region (BlockAllocator<T>& alloc) {
+		add_region(alloc.arr, alloc.commit_size());
+	}
+	void add_region (VirtualPushAllocator& alloc) {
+		add_region(alloc.base(), alloc.commit_size());
+	}
+	// update the region sizes to what is currently committed, call before begin() if the allocators grew
+	template <typename T>
+	void update_region (int idx, BlockAllocator<T>& alloc) {
+		assert(!active && regions[idx].base == (char*)alloc.arr);
+		regions[idx].size = alloc.commit_size();
+	}
+	void update_region (int idx, VirtualPushAllocator& alloc) {
+		assert(!active && regions[idx].base == alloc.base());
+		regions[idx].size = alloc.commit_size();
+	}
+
+	// write protect all regions, from now on read_pages sees the memory as it is now
+	// not threadsafe with allocators committing or decommitting in the regions
+	void begin (bool copy_on_write=true);
+
+	// unprotect all pages, read_pages may not be running anymore
+	// dirty flags stay available
+	void end ();
+
+	// stream the snapshot with template callback 'void func (int region, size_t offset, void const* data, size_t size)' in order of regions and offsets
+	// call from any thread between begin() and end(), data is only valid during the callback
+	// while a live page is being read writes to it wait, so keep the callback fast (ie. copy into a write buffer)
+	template <typename FUNC>
+	void read_pages (FUNC func) {
+		assert(active && copy_on_write);
+		size_t page_size = os_page_size;
+
+		for (int r=0; r<(int)regions.size(); ++r) {
+			auto& reg = regions[r];
+			for (size_t i=0; i<reg.page_count; ++i) {
+				size_t offset = i * page_size;
+				size_t size = std::min(page_size, reg.size - offset);
+
+				if (_begin_read_page(reg, i)) {
+					func(r, offset, reg.base + offset, size);
+					_end_read_page(reg, i);
+				} else {
+					func(r, offset, reg.shadow + offset, size);
+				}
+			}
+		}
+	}
+
+	bool is_dirty (int region, size_t page) const {
+		return (regions[region].pages[page].load(std::memory_order_relaxed) & PAGE_DIRTY) != 0;
+	}
+	// call template callback 'void func (int region, size_t offset, size_t size)' for every page written since begin()
+	template <typename FUNC>
+	void for_each_dirty_page (FUNC func) {
+		size_t page_size = os_page_size;
+		for (int r=0; r<(int)regions.size(); ++r) {
+			auto& reg = regions[r];
+			for (size_t i=0; i<reg.page_count; ++i) {
+				if (reg.pages[i].load(std::memory_order_relaxed) & PAGE_DIRTY)
+					func(r, i * page_size, std::min(page_size, reg.size - i * page_size));
+			}
+		}
+	}
+
+	// returns true if the live page needs to be read (and _end_read_page called), false if the shadow copy has to be used
+	bool _begin_read_page (Region& reg, size_t page);
+	void _end_read_page (Region& reg, size_t page);
+
+	// called by the platform fault handler, returns false if the address does not belong to the snapshot
+	bool _handle_write_fault (void* addr);
+	void _before_decommit (void* ptr, size_t size);
+};
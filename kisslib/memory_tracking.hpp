@@ -0,0 +1,209 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+
+// Memory accounting per category
+// kisslib allocators, tracked stl containers and gl buffers/textures report their allocations with a MemTag,
+// which gives live bytes, peak, alloc/s and outstanding allocations per category, shown against soft budgets in the engine's Memory panel
+/* pattern:
+	BlockAllocator<Chunk> chunks (MAX_CHUNKS);
+	chunks.set_tag(MEMTAG_CHUNKS);
+
+	tracked_vector<Vertex, MEMTAG_MESHES> verts;
+
+	g_mem_tracker.budgets[MEMTAG_TEXTURES] = 512*MB;
+*/
+// (0) -> tracking compiles to nothing  (1) -> enabled, costs two relaxed atomic adds per alloc/free
+// which is a large part of the cost of fast allocators (TlsfAllocator thread cache hits), so it's only on by default in debug and profiling (TRACY_ENABLE) builds
+#ifndef MEMORY_TRACKING
+	#if !defined(NDEBUG) || defined(TRACY_ENABLE)
+		#define MEMORY_TRACKING 1
+	#else
+		#define MEMORY_TRACKING 0
+	#endif
+#endif
+
+enum MemTag : uint8_t {
+	MEMTAG_OTHER = 0,
+	MEMTAG_TEXTURES,
+	MEMTAG_MESHES,
+	MEMTAG_CHUNKS,
+	MEMTAG_UI,
+	MEMTAG_JSON,
+
+	MEMTAG_COUNT
+};
+inline constexpr const char* MEMTAG_NAMES[MEMTAG_COUNT] = {
+	"other",
+	"textures",
+	"meshes",
+	"chunks",
+	"ui",
+	"json",
+};
+
+struct MemTracker {
+	// own cache line per tag, so threads allocating in different categories don't contend
+	struct alignas(64) Counters {
+		std::atomic<int64_t>	live_bytes = 0;
+		std::atomic<int64_t>	peak_bytes = 0;
+		std::atomic<uint64_t>	allocs = 0;
+		std::atomic<uint64_t>	frees = 0;
+
+		int64_t outstanding () const {
+			return (int64_t)(allocs.load(std::memory_order_relaxed) - frees.load(std::memory_order_relaxed));
+		}
+	};
+	Counters	tags[MEMTAG_COUNT];
+
+	// soft limits in bytes, exceeding them only warns, 0 -> no limit
+	size_t		budgets[MEMTAG_COUNT] = {};
+
+	// updated by update()
+	float		alloc_rate[MEMTAG_COUNT] = {}; // allocs per second
+	bool		over_budget[MEMTAG_COUNT] = {};
+
+	float		_rate_timer = 0;
+	uint64_t	_rate_allocs[MEMTAG_COUNT] = {};
+
+	// live gpu (or other external) resources by key, so that they can be untracked by key only
+	struct Resource {
+		MemTag	tag;
+		size_t	size;
+	};
+	std::mutex									_resource_mutex;
+	std::unordered_map<uint64_t, Resource>		_resources;
+
+	void on_alloc (MemTag tag, size_t size, uint64_t count=1) {
+		auto& c = tags[tag];
+		int64_t live = c.live_bytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+		c.allocs.fetch_add(count, std::memory_order_relaxed);
+
+		int64_t peak = c.peak_bytes.load(std::memory_order_relaxed);
+		while (live > peak && !c.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+	}
+	void on_free (MemTag tag, size_t size, uint64_t count=1) {
+		auto& c = tags[tag];
+		c.live_bytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+		c.frees.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	// track a resource that is identified by key instead of a pointer (ie. gl names), changing the size of a tracked key does not count as an alloc
+	void track_resource (uint64_t key, MemTag tag, size_t size) {
+		std::lock_guard lock(_resource_mutex);
+		auto it = _resources.find(key);
+		if (it == _resources.end()) {
+			_resources.emplace(key, Resource{ tag, size });
+			on_alloc(tag, size);
+			return;
+		}
+
+		auto& res = it->second;
+		on_free(res.tag, res.size, 0);
+		on_alloc(tag, size, 0);
+		res = { tag, size };
+	}
+	void untrack_resource (uint64_t key) {
+		std::lock_guard lock(_resource_mutex);
+		auto it = _resources.find(key);
+		if (it == _resources.end())
+			return; // was never given a size
+		on_free(it->second.tag, it->second.size);
+		_resources.erase(it);
+	}
+
+	// call once per frame, updates alloc_rate and over_budget, returns the tag that went over its budget this frame or -1
+	int update (float dt) {
+		_rate_timer += dt;
+		if (_rate_timer >= 1.0f) {
+			for (int i=0; i<MEMTAG_COUNT; ++i) {
+				uint64_t allocs = tags[i].allocs.load(std::memory_order_relaxed);
+				alloc_rate[i] = (float)(allocs - _rate_allocs[i]) / _rate_timer;
+				_rate_allocs[i] = allocs;
+			}
+			_rate_timer = 0;
+		}
+
+		int exceeded = -1;
+		for (int i=0; i<MEMTAG_COUNT; ++i) {
+			bool over = budgets[i] > 0 && tags[i].live_bytes.load(std::memory_order_relaxed) > (int64_t)budgets[i];
+			if (over && !over_budget[i])
+				exceeded = i;
+			over_budget[i] = over;
+		}
+		return exceeded;
+	}
+
+	void reset_peaks () {
+		for (auto& c : tags)
+			c.peak_bytes.store(c.live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+};
+
+inline MemTracker g_mem_tracker;
+
+#if MEMORY_TRACKING
+	#define MEMTRACK_ALLOC(tag, size) g_mem_tracker.on_alloc(tag, size)
+	#define MEMTRACK_FREE(tag, size) g_mem_tracker.on_free(tag, size)
+	#define MEMTRACK_ALLOC_N(tag, size, count) g_mem_tracker.on_alloc(tag, size, count)
+	#define MEMTRACK_FREE_N(tag, size, count) g_mem_tracker.on_free(tag, size, count)
+	#define MEMTRACK_RESOURCE(key, tag, size) g_mem_tracker.track_resource(key, tag, size)
+	#define MEMTRACK_RESOURCE_FREE(key) g_mem_tracker.untrack_resource(key)
+#else
+	#define MEMTRACK_ALLOC(tag, size)
+	#define MEMTRACK_FREE(tag, size)
+	#define MEMTRACK_ALLOC_N(tag, size, count)
+	#define MEMTRACK_FREE_N(tag, size, count)
+	#define MEMTRACK_RESOURCE(key, tag, size)
+	#define MEMTRACK_RESOURCE_FREE(key)
+#endif
+
+// malloc based stl allocator that counts towards TAG
+template <typename T, MemTag TAG>
+struct TrackedSTLAllocator {
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind { typedef TrackedSTLAllocator<U, TAG> other; };
+
+	TrackedSTLAllocator () noexcept {}
+	template <typename U>
+	TrackedSTLAllocator (TrackedSTLAllocator<U, TAG> const&) noexcept {}
+
+	T* allocate (size_t n) {
+		T* ptr = (T*)std::malloc(n * sizeof(T));
+		if (!ptr) throw std::bad_alloc();
+		MEMTRACK_ALLOC(TAG, n * sizeof(T));
+		return ptr;
+	}
+	void deallocate (T* ptr, size_t n) {
+		MEMTRACK_FREE(TAG, n * sizeof(T));
+		std::free(ptr);
+	}
+
+	template <typename U>
+	bool operator== (TrackedSTLAllocator<U, TAG> const&) const { return true; }
+	template <typename U>
+	bool operator!= (TrackedSTLAllocator<U, TAG> const&) const { return false; }
+};
+
+template <typename T, MemTag TAG>
+using tracked_vector = std::vector<T, TrackedSTLAllocator<T, TAG>>;
+
+template <MemTag TAG>
+using tracked_string = std::basic_string<char, std::char_traits<char>, TrackedSTLAllocator<char, TAG>>;
+
+template <typename Key, typename T, MemTag TAG, typename Hash = std::hash<Key>, typename Pred = std::equal_to<Key>>
+using tracked_unordered_map = std::unordered_map<Key, T, Hash, Pred, TrackedSTLAllocator<std::pair<const Key, T>, TAG>>;
+
+template <typename Key, MemTag TAG, typename Hash = std::hash<Key>, typename Pred = std::equal_to<Key>>
+using tracked_unordered_set = std::unordered_set<Key, Hash, Pred, TrackedSTLAllocator<Key, TAG>>;
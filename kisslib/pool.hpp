@@ -0,0 +1,116 @@
+#pragma once
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+#include "allocator.hpp"
+
+// BlockAllocator that constructs and destructs it's objects and can iterate all live objects
+// objects never move, so indices and pointers stay valid until free()
+/* pattern:
+	Pool<Entity> entities (1u << 20);
+
+	uint32_t id = entities.alloc(pos, vel);
+	entities.for_each([&] (Entity& e) {
+		e.pos += e.vel * dt;
+	});
+	entities.free(id);
+*/
+// iteration walks the allocation bitset: summary words skip runs of 4096 free slots, bitset words skip runs of 64,
+// and within a word the live objects are found with bitscans, so the cost is proportional to the live objects, not max_count
+template <typename T>
+class Pool {
+	NO_MOVE_COPY_CLASS(Pool)
+
+	BlockAllocator<T>	blocks;
+
+public:
+	Pool (uint32_t max_count, bool large_pages=false): blocks{max_count, large_pages} {}
+
+	~Pool () {
+		clear();
+	}
+
+	template <typename... ARGS>
+	uint32_t alloc (ARGS&&... args) {
+		uint32_t idx = blocks.alloc();
+		new (&blocks[idx]) T(std::forward<ARGS>(args)...);
+		return idx;
+	}
+
+	void free (uint32_t idx) {
+		assert(is_allocated(idx));
+		blocks[idx].~T();
+		blocks.free(idx);
+	}
+
+	bool is_allocated (uint32_t idx) const {
+		auto& slots = blocks.slots;
+		return idx < slots.alloc_end && (slots.bits[idx >> 6] & (1ull << (idx & 63))) == 0;
+	}
+
+	T& operator[] (uint32_t idx) {
+		assert(is_allocated(idx));
+		return blocks[idx];
+	}
+	T const& operator[] (uint32_t idx) const {
+		assert(is_allocated(idx));
+		return blocks[idx];
+	}
+
+	uint32_t size () const {
+		return blocks.count;
+	}
+	// one past the highest live index
+	uint32_t alloc_end () const {
+		return blocks.slots.alloc_end;
+	}
+
+	// call template callback 'void func (T&)' or 'void func (uint32_t idx, T&)' for every live object in index order
+	// objects may not be allocated or freed during the iteration
+	template <typename FUNC>
+	void for_each (FUNC func) {
+		auto& slots = blocks.slots;
+
+		for (uint32_t i1=0; i1<(uint32_t)slots.alloc_l1.size(); ++i1) {
+			uint64_t words = slots.alloc_l1[i1]; // 1 = word contains allocated slots
+			while (words) {
+				uint32_t w = (i1 << 6) + _bsf_1(words);
+				words &= words - 1;
+
+				uint64_t live = ~slots.bits[w]; // 1 = allocated
+				while (live) {
+					uint32_t idx = (w << 6) + _bsf_1(live);
+					live &= live - 1;
+
+					if constexpr (std::is_invocable_v<FUNC, uint32_t, T&>)
+						func(idx, blocks[idx]);
+					else
+						func(blocks[idx]);
+				}
+			}
+		}
+	}
+
+	// destruct and free all objects
+	void clear () {
+		if constexpr (!std::is_trivially_destructible_v<T>) {
+			for_each([] (T& obj) {
+				obj.~T();
+			});
+		}
+
+		// free from the back so every free() is cheap and memory is decommitted along the way
+		for (uint32_t idx=blocks.slots.alloc_end; idx-- > 0;) {
+			if (is_allocated(idx))
+				blocks.free(idx);
+		}
+	}
+
+	// how many bytes are commited
+	size_t commit_size () const {
+		return blocks.commit_size();
+	}
+};
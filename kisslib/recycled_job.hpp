@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <new>
+#include "stdint.h"
+#include "assert.h"
+
+// Recycles the memory of jobs instead of going through malloc/free for every job
+// derive the job from RecycledJob<Job> and keep using std::make_unique<Job>() and std::unique_ptr<Job> as usual,
+// the class operator new/delete take and return memory from a thread-local free list
+//  jobs are usually allocated and freed on the same thread (pushed and results popped on the main thread), so in steady state this never calls malloc
+//  jobs freed on other threads end up in that threads list, full lists hand batches to a global list, empty lists take batches from it
+/* pattern:
+	struct ChunkJob : RecycledJob<ChunkJob> {
+		...
+		void execute ();
+	};
+	threadpool.jobs.push(std::make_unique<ChunkJob>(...));
+*/
+// memory is never returned to the os (free lists keep the high-water mark), call trim() to free the global list (ie. after a level load)
+template <typename T>
+class RecycledJob {
+	struct FreeNode {
+		FreeNode* next;
+	};
+	struct Batch {
+		FreeNode*	head;
+		int			count;
+	};
+
+	// size of batches handed between threads, thread-local lists hold at most 2 batches
+	static constexpr int BATCH = 64;
+
+	struct ThreadCache {
+		FreeNode*	head = nullptr;
+		int			count = 0;
+
+		~ThreadCache () {
+			// thread exits, give everything to the global list
+			if (head)
+				_push_global({ head, count });
+		}
+	};
+
+	static inline thread_local ThreadCache cache;
+
+	static inline std::mutex			global_mutex;
+	static inline std::vector<Batch>	global_batches;
+
+	static void _push_global (Batch batch) {
+		std::lock_guard lock(global_mutex);
+		global_batches.push_back(batch);
+	}
+	static bool _pop_global (Batch* batch) {
+		std::lock_guard lock(global_mutex);
+		if (global_batches.empty())
+			return false;
+		*batch = global_batches.back();
+		global_batches.pop_back();
+		return true;
+	}
+
+public:
+	struct Stats {
+		std::atomic<uint64_t> heap_allocs = 0;     // allocations that had to call ::operator new
+		std::atomic<uint64_t> recycled_allocs = 0; // allocations served from a free list
+		std::atomic<uint64_t> frees = 0;
+	};
+	static inline Stats stats;
+
+	static void* operator new (size_t size) {
+		static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "RecycledJob: overaligned jobs not supported");
+		if (size != sizeof(T)) // derived class of the job, can't recycle
+			return ::operator new(size);
+
+		auto& c = cache;
+		if (!c.head) {
+			Batch batch;
+			if (_pop_global(&batch)) {
+				c.head = batch.head;
+				c.count = batch.count;
+			}
+		}
+
+		if (c.head) {
+			FreeNode* node = c.head;
+			c.head = node->next;
+			c.count--;
+
+			stats.recycled_allocs.fetch_add(1, std::memory_order_relaxed);
+			return node;
+		}
+
+		stats.heap_allocs.fetch_add(1, std::memory_order_relaxed);
+		return ::operator new(sizeof(T) < sizeof(FreeNode) ? sizeof(FreeNode) : sizeof(T));
+	}
+
+	static void operator delete (void* ptr, size_t size) {
+		if (!ptr) return;
+		if (size != sizeof(T)) {
+			::operator delete(ptr);
+			return;
+		}
+
+		stats.frees.fetch_add(1, std::memory_order_relaxed);
+
+		auto& c = cache;
+		if (c.count >= BATCH*2) {
+			// hand the oldest BATCH nodes to the global list
+			// walk to the BATCH-th node, the nodes after it form the batch
+			FreeNode* last = c.head;
+			for (int i=1; i<BATCH; ++i)
+				last = last->next;
+
+			_push_global({ last->next, c.count - BATCH });
+			last->next = nullptr;
+			c.count = BATCH;
+		}
+
+		FreeNode* node = (FreeNode*)ptr;
+		node->next = c.head;
+		c.head = node;
+		c.count++;
+	}
+
+	// free all memory in the global list (memory in thread-local lists stays)
+	static void trim () {
+		std::vector<Batch> batches;
+		{
+			std::lock_guard lock(global_mutex);
+			batches.swap(global_batches);
+		}
+		for (auto& b : batches) {
+			for (FreeNode* node = b.head; node;) {
+				FreeNode* next = node->next;
+				::operator delete(node);
+				node = next;
+			}
+		}
+	}
+};
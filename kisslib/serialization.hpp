@@ -4,8 +4,14 @@
 #include "file_io.hpp"
 #include "kissmath.hpp"
 #include "tracy/Tracy.hpp"
+#include "memory_tracking.hpp"
 #include <memory>
-using json = nlohmann::ordered_json;
+
+template <typename T>
+using JsonAllocator = TrackedSTLAllocator<T, MEMTAG_JSON>;
+// nlohmann::ordered_json with objects and arrays counted as MEMTAG_JSON (string contents use std::string and are not counted)
+// this is a different type than nlohmann::ordered_json, so to_json/from_json and adl_serializers have to take json
+using json = nlohmann::basic_json<nlohmann::ordered_map, std::vector, std::string, bool, std::int64_t, std::uint64_t, double, JsonAllocator>;
 
 #ifndef SERIALIZE_LOG
 	#include "stdio.h"
@@ -122,8 +128,8 @@ inline T deserialize (char const* filename) {
 #define _JSON_PASTE19(func, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15, v16, v17, v18, v19)       func(v1) _JSON_PASTE18(func, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15, v16, v17, v18, v19)
 #define _JSON_PASTE20(func, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15, v16, v17, v18, v19, v20)  func(v1) _JSON_PASTE19(func, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15, v16, v17, v18, v19, v20)
 
-#define SERIALIZE_TO_JSON(Type) void to_json(nlohmann::ordered_json& j, const Type& t)
-#define SERIALIZE_FROM_JSON(Type) void from_json(const nlohmann::ordered_json& j, Type& t)
+#define SERIALIZE_TO_JSON(Type) void to_json(json& j, const Type& t)
+#define SERIALIZE_FROM_JSON(Type) void from_json(const json& j, Type& t)
 
 // Cannot handle zero arguments because preprocessor is badly designed
 
@@ -141,12 +147,12 @@ inline T deserialize (char const* filename) {
 // Macros can't handle no arguments, instead use this version if class gets serialized somehere but calls does not want to serialize any members
 // assign an ampty object because otherside j ends up as null
 #define SERIALIZE_NONE(Type, ...)  \
-    friend SERIALIZE_TO_JSON(Type)   { j = nlohmann::ordered_json::object(); } \
+    friend SERIALIZE_TO_JSON(Type)   { j = json::object(); } \
     friend SERIALIZE_FROM_JSON(Type) {}
 
 namespace nlohmann {
 	template <typename KeyT, typename T>
-	bool try_get_to (nlohmann::ordered_json const& j, KeyT const& key, T& t) {
+	bool try_get_to (json const& j, KeyT const& key, T& t) {
 		if (j.contains(key)) {
 			j[key].get_to(t);
 			return true;
@@ -160,10 +166,10 @@ namespace nlohmann {
 	template<typename T>
 	struct adl_serializer<std::unique_ptr<T>> {
 		using type = std::unique_ptr<T>;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = *val;
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			val = std::make_unique<T>();
 			j.get_to(*val);
 		}
@@ -172,10 +178,10 @@ namespace nlohmann {
 	template<typename T>
 	struct adl_serializer<std::unique_ptr<T>> {
 		using type = std::unique_ptr<T>;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = *val; // This is safe
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			// Just don't deserialize if ptr is null, this is safe, but might not be what you want
 			// Think std::vector<std::unique_ptr<T>>, where depending on what's in the file, you might want the vector to be filled with new ptrs
 			// Could override vectors of uptrs specifically, or just manually deserialize?
@@ -185,10 +191,10 @@ namespace nlohmann {
 
 	template <>	struct adl_serializer<int2> {
 		using type = int2;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -198,10 +204,10 @@ namespace nlohmann {
 
 	template <>	struct adl_serializer<int3> {
 		using type = int3;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -212,10 +218,10 @@ namespace nlohmann {
 
 	template <>	struct adl_serializer<int4> {
 		using type = int4;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -227,10 +233,10 @@ namespace nlohmann {
 
 	template <>	struct adl_serializer<float2> {
 		using type = float2;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -240,10 +246,10 @@ namespace nlohmann {
 
 	template <>	struct adl_serializer<float3> {
 		using type = float3;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y, val.z };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -254,10 +260,10 @@ namespace nlohmann {
 
 	template <>	struct adl_serializer<float4> {
 		using type = float4;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y, val.z, val.w };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -269,10 +275,10 @@ namespace nlohmann {
 
 	template <>	struct adl_serializer<srgb8> {
 		using type = srgb8;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y, val.z };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -282,10 +288,10 @@ namespace nlohmann {
 	};
 	template <>	struct adl_serializer<srgba8> {
 		using type = srgba8;
-		static void to_json(ordered_json& j, const type& val) {
+		static void to_json(::json& j, const type& val) {
 			j = { val.x, val.y, val.z, val.w };
 		}
-		static void from_json(const ordered_json& j, type& val) {
+		static void from_json(const ::json& j, type& val) {
 			if (!j.is_array()) return;
 			size_t len = j.size();
 			if (len >= 1) j.at(0).get_to(val.x);
@@ -296,4 +302,22 @@ namespace nlohmann {
 	};
 }
 
+// compile check: SERIALIZE'd types (with members using the adl_serializers above) convert to json and back
+namespace _serialize_check {
+	struct Check {
+		int							a = 0;
+		float3						b = 0;
+		std::vector<int2>			v;
+		std::unique_ptr<float2>		p = std::make_unique<float2>(0.0f);
+		SERIALIZE(Check, a, b, v, p)
+	};
+	static_assert(std::is_constructible_v<json, Check const&>, "SERIALIZE'd types must convert to json");
+	static_assert(nlohmann::detail::has_from_json<json, Check>::value, "SERIALIZE'd types must convert from json");
+
+	inline void round_trip (Check& c) {
+		json j = c;
+		j.get_to(c);
+	}
+}
+
 #undef SERIALIZE_LOG
@@ -0,0 +1,140 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+#include "allocator.hpp"
+
+// Handle based container with O(1) insert, remove and lookup, and iteration over a packed std::vector of the live values
+// handles stay valid until their item is removed, after that lookups simply fail, even if the slot was reused for a new item
+// use instead of raw BlockAllocator indices or hash maps of ids for references that can outlive the item
+/* pattern:
+	SlotMap<Entity> entities (1u << 20);
+
+	auto h = entities.insert(Entity{...});
+	if (auto* e = entities.get(h)) // nullptr if removed
+		e->pos += vel;
+
+	for (auto& e : entities) // iterates a packed vector in no particular order
+		update(e);
+*/
+// pointers to values are invalidated by insert() and remove() since values get moved around to stay packed
+template <typename T>
+class SlotMap {
+	NO_MOVE_COPY_CLASS(SlotMap)
+public:
+	struct Handle {
+		uint32_t index = (uint32_t)-1;
+		uint32_t generation = 0; // never 0 for handles returned by insert, so default constructed handles are always invalid
+
+		bool operator== (Handle const& r) const { return index == r.index && generation == r.generation; }
+		bool operator!= (Handle const& r) const { return !(*this == r); }
+	};
+
+private:
+	struct Slot {
+		uint32_t	dense; // index into values
+		uint32_t	generation; // 0 while slot is free
+	};
+
+	BlockAllocator<Slot>	slots; // sparse, indexed by Handle::index
+	std::vector<T>			values; // dense
+	std::vector<uint32_t>	dense_to_slot; // back-pointers from values to slots, to fix up slots when values move
+
+	// slots get decommitted (and zeroed) by BlockAllocator, so per-slot counters would restart and match stale handles again,
+	// instead every insert takes a new generation from this counter, which only repeats after 2^32 inserts
+	uint32_t				next_generation = 1;
+
+public:
+	SlotMap (uint32_t max_count): slots{max_count} {}
+
+	template <typename... ARGS>
+	Handle emplace (ARGS&&... args) {
+		uint32_t idx = slots.alloc();
+
+		uint32_t gen = next_generation++;
+		if (next_generation == 0) next_generation = 1;
+
+		slots[idx] = { (uint32_t)values.size(), gen };
+		values.emplace_back(std::forward<ARGS>(args)...);
+		dense_to_slot.push_back(idx);
+
+		return { idx, gen };
+	}
+	Handle insert (T val) {
+		return emplace(std::move(val));
+	}
+
+	// returns false if the item was already removed
+	bool remove (Handle h) {
+		if (!contains(h))
+			return false;
+
+		uint32_t dense = slots[h.index].dense;
+		uint32_t last = (uint32_t)values.size() - 1;
+
+		// move last value into the hole to stay packed
+		if (dense != last) {
+			values[dense] = std::move(values[last]);
+			dense_to_slot[dense] = dense_to_slot[last];
+			slots[dense_to_slot[dense]].dense = dense;
+		}
+		values.pop_back();
+		dense_to_slot.pop_back();
+
+		slots[h.index].generation = 0;
+		slots.free(h.index);
+		return true;
+	}
+
+	// O(1) check without touching the values
+	bool contains (Handle h) const {
+		// slots past alloc_end can be decommitted, slots before are committed and have generation 0 if free
+		return h.index < slots.slots.alloc_end && slots[h.index].generation == h.generation;
+	}
+
+	// returns nullptr if the item was removed
+	T* get (Handle h) {
+		return contains(h) ? &values[slots[h.index].dense] : nullptr;
+	}
+	T const* get (Handle h) const {
+		return contains(h) ? &values[slots[h.index].dense] : nullptr;
+	}
+
+	T& operator[] (Handle h) {
+		assert(contains(h));
+		return values[slots[h.index].dense];
+	}
+	T const& operator[] (Handle h) const {
+		assert(contains(h));
+		return values[slots[h.index].dense];
+	}
+
+	// handle of the i-th packed value, for iterating with handles
+	Handle handle_at (uint32_t i) const {
+		uint32_t idx = dense_to_slot[i];
+		return { idx, slots[idx].generation };
+	}
+
+	uint32_t size () const { return (uint32_t)values.size(); }
+	bool empty () const { return values.empty(); }
+
+	// the packed values, to iterate or index with [0, size())
+	T* data () { return values.data(); }
+	T const* data () const { return values.data(); }
+
+	auto begin () { return values.begin(); }
+	auto end () { return values.end(); }
+	auto begin () const { return values.begin(); }
+	auto end () const { return values.end(); }
+
+	void clear () {
+		for (uint32_t idx : dense_to_slot) {
+			slots[idx].generation = 0;
+			slots.free(idx);
+		}
+		values.clear();
+		dense_to_slot.clear();
+	}
+};
@@ -10,7 +10,11 @@ namespace kiss {
 	void vprints (std::string* s, char const* format, va_list vl) { // print 
 		size_t old_size = s->size();
 		for (;;) {
-			auto ret = vsnprintf(&(*s)[old_size], s->size() -old_size +1, format, vl); // i think i'm technically not allowed to overwrite the null terminator
+			// vsnprintf consumes the va_list, so use a copy in case we need to call it a second time
+			va_list vl2;
+			va_copy(vl2, vl);
+			auto ret = vsnprintf(&(*s)[old_size], s->size() -old_size +1, format, vl2); // i think i'm technically not allowed to overwrite the null terminator
+			va_end(vl2);
 			ret = ret >= 0 ? ret : 0;
 			bool was_bienough = (size_t)ret < (s->size() -old_size +1);
 			s->resize(old_size +ret);
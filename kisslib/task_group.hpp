@@ -0,0 +1,130 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include "macros.hpp"
+#include "threadsafe_ring_queue.hpp"
+
+// Lightweight fork-join tasks that run on the threads of a Threadpool next to it's jobs
+// tasks are stored by value in a lock-free ring, so running a task never allocates (unlike jobs, which are unique_ptrs)
+
+class TaskGroup;
+
+// type-erased callable with inline storage
+// not just 'Task', which would clash with the coroutine kiss::Task<T> in code that does using namespace kiss
+struct PoolTask {
+	static constexpr size_t STORAGE_SIZE = 48;
+
+	void		(*invoke) (PoolTask& task) = nullptr;
+	TaskGroup*	group = nullptr;
+	alignas(16) char storage[STORAGE_SIZE];
+
+	inline void run ();
+};
+
+// queue of tasks owned by a Threadpool
+class PoolTaskQueue {
+	ThreadsafeRingQueue<PoolTask> q = ThreadsafeRingQueue<PoolTask>(1024);
+
+public:
+	// set by the owning threadpool, called after every push to wake up it's sleeping threads
+	void	(*wake_threads) (void* ctx) = nullptr;
+	void*	wake_ctx = nullptr;
+
+	bool empty () const {
+		return q.empty();
+	}
+
+	// returns false if the queue is full, in that case the caller should run the task itself
+	bool push (PoolTask& task) {
+		if (!q.try_push(std::move(task)))
+			return false;
+
+		// pairs with the fence threads do before checking empty() and going to sleep
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (wake_threads)
+			wake_threads(wake_ctx);
+		return true;
+	}
+
+	// run one queued task if there is one
+	bool try_run_one () {
+		PoolTask task;
+		if (!q.try_pop(&task))
+			return false;
+		task.run();
+		return true;
+	}
+};
+
+// fork-join group of tasks
+// run() queues tasks, wait() returns once all of them are done, the waiting thread helps run tasks in the meantime
+/* pattern:
+	TaskGroup group(threadpool);
+	group.run([&] () { cull(cameras[0]); });
+	group.run([&] () { cull(cameras[1]); });
+	build_meshes();
+	group.wait();
+*/
+// callables need to fit into PoolTask::STORAGE_SIZE and be trivially copyable (ie. lambdas capturing by reference or small values)
+// since they are only valid until wait() returns capturing locals by reference is fine
+class TaskGroup {
+	NO_MOVE_COPY_CLASS(TaskGroup)
+
+	PoolTaskQueue&			tasks;
+	std::atomic<uint32_t>	pending = 0;
+
+public:
+	TaskGroup (PoolTaskQueue& tasks): tasks{tasks} {}
+	template <typename POOL>
+	TaskGroup (POOL& pool): tasks{pool.tasks} {}
+
+	~TaskGroup () {
+		wait();
+	}
+
+	template <typename FUNC>
+	void run (FUNC func) {
+		static_assert(sizeof(FUNC) <= PoolTask::STORAGE_SIZE && alignof(FUNC) <= 16, "TaskGroup: callable too large, capture by reference instead");
+		static_assert(std::is_trivially_copyable_v<FUNC> && std::is_trivially_destructible_v<FUNC>, "TaskGroup: callable needs to be trivially copyable, capture by reference instead");
+
+		PoolTask task;
+		task.group = this;
+		task.invoke = [] (PoolTask& task) {
+			(*(FUNC*)task.storage)();
+		};
+		new (task.storage) FUNC(func);
+
+		pending.fetch_add(1, std::memory_order_relaxed);
+
+		if (!tasks.push(task))
+			task.run(); // queue full, just run it ourselves
+	}
+
+	// wait until all tasks run via this group are done, runs queued tasks (of any group) while waiting
+	void wait () {
+		for (;;) {
+			uint32_t count = pending.load(std::memory_order_acquire);
+			if (count == 0)
+				return;
+
+			if (tasks.try_run_one())
+				continue;
+
+			// nothing left to help with, the remaining tasks are running on other threads
+			pending.wait(count, std::memory_order_acquire);
+		}
+	}
+
+	void _finish () {
+		// only wake the waiter once the last task is done
+		if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			pending.notify_all();
+	}
+};
+
+void PoolTask::run () {
+	invoke(*this);
+	if (group) // null for tasks that are not part of a group (ie. resumed coroutines)
+		group->_finish();
+}
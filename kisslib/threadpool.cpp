@@ -1,5 +1,60 @@
 ﻿#include "threadpool.hpp"
 #include "assert.h"
+#include <algorithm>
+
+// implemented per platform below, see finalize_topology for the expected ids
+static CpuTopology detect_cpu_topology ();
+
+// assign dense physical core indices and sort them by locality to the main thread's core
+// expects cpu.core and cpu.l3 to be filled with arbitrary (os specific) ids
+static void finalize_topology (CpuTopology& topo) {
+	if (topo.cpus.empty()) {
+		// os did not tell us anything, assume every logical cpu is it's own core
+		int count = std::max((int)std::thread::hardware_concurrency(), 1);
+		for (int i=0; i<count; ++i)
+			topo.cpus.push_back({ i, i, -1 });
+	}
+
+	std::sort(topo.cpus.begin(), topo.cpus.end(), [] (CpuTopology::LogicalCpu const& l, CpuTopology::LogicalCpu const& r) {
+		return l.id < r.id;
+	});
+
+	// remap os core ids to 0..n-1 in order of first logical cpu, so core 0 is the one containing cpu 0
+	std::vector<int> core_ids, l3_of_core;
+	for (auto& cpu : topo.cpus) {
+		auto it = std::find(core_ids.begin(), core_ids.end(), cpu.core);
+		if (it == core_ids.end()) {
+			core_ids.push_back(cpu.core);
+			l3_of_core.push_back(cpu.l3);
+			it = core_ids.end() -1;
+		}
+		cpu.core = (int)(it - core_ids.begin());
+	}
+	topo.physical_cores = (int)core_ids.size();
+
+	int main_core = std::min(MAIN_THREAD_CORE, topo.physical_cores -1);
+	int main_l3 = l3_of_core[main_core];
+
+	topo.cores_by_locality.clear();
+	topo.cores_by_locality.push_back(main_core);
+	for (int pass=0; pass<2; ++pass) {
+		for (int core=0; core<topo.physical_cores; ++core) {
+			if (core == main_core) continue;
+			bool shares_l3 = main_l3 >= 0 && l3_of_core[core] == main_l3;
+			if (shares_l3 == (pass == 0))
+				topo.cores_by_locality.push_back(core);
+		}
+	}
+}
+
+CpuTopology const& get_cpu_topology () {
+	static CpuTopology topo = [] () {
+		auto topo = detect_cpu_topology();
+		finalize_topology(topo);
+		return topo;
+	}();
+	return topo;
+}
 
 #ifdef _WIN32
 	#undef WIN32_LEAN_AND_MEAN
@@ -73,6 +128,38 @@
 		//auto ret = SetThreadIdealProcessor(GetCurrentThread(), preferred_core);
 		//assert(ret >= 0);
 	}
+	void set_thread_excluded_core (int core_index) {
+		
+	}
+
+	static CpuTopology detect_cpu_topology () {
+		CpuTopology topo;
+
+		DWORD size = 0;
+		GetLogicalProcessorInformation(nullptr, &size);
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+		if (infos.empty() || !GetLogicalProcessorInformation(infos.data(), &size))
+			return topo;
+
+		// identify cores and L3 domains by their index in the info array
+		for (int i=0; i<(int)infos.size(); ++i) {
+			if (infos[i].Relationship != RelationProcessorCore) continue;
+
+			for (int bit=0; bit<(int)sizeof(ULONG_PTR)*8; ++bit) {
+				if (infos[i].ProcessorMask & ((ULONG_PTR)1 << bit))
+					topo.cpus.push_back({ bit, i, -1 });
+			}
+		}
+		for (int i=0; i<(int)infos.size(); ++i) {
+			if (infos[i].Relationship != RelationCache || infos[i].Cache.Level != 3) continue;
+
+			for (auto& cpu : topo.cpus) {
+				if (infos[i].ProcessorMask & ((ULONG_PTR)1 << cpu.id))
+					cpu.l3 = i;
+			}
+		}
+		return topo;
+	}
 
 	void set_thread_description (std::string_view description) {
 		SetThreadDescription(GetCurrentThread(), kiss::utf8_to_wchar(description).c_str());
@@ -100,6 +187,154 @@
 	} _setWindowsSchedFreq; // set timeBeginPeriod at startup
 #endif
 
+#elif defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+	#include <unistd.h>
+	#include <sys/resource.h>
+	#include <sys/syscall.h>
+	#include <stdio.h>
+	#include <string.h>
+
+	// Like on windows we don't bump the process priority for now, a negative nice needs CAP_SYS_NICE anyway
+	void set_process_priority () {
+	//#ifdef NDEBUG
+	//	auto ret = setpriority(PRIO_PROCESS, 0, -5);
+	//	assert(ret == 0);
+	//#endif
+	}
+
+	// On linux nice values are per thread (setpriority with a tid only affects that thread, despite what posix says)
+	// raising priority (negative nice) only works with CAP_SYS_NICE or a fitting RLIMIT_NICE, so failure is expected and ignored
+	//  in that case main and parallelism threads simply stay at the default priority
+	// background threads use SCHED_IDLE, which only gets cpu time when no normal thread wants to run
+	//  this is the closest equivalent to THREAD_PRIORITY_LOWEST on windows, which also starves under load
+	void set_thread_priority (ThreadPrio prio) {
+		pid_t tid = (pid_t)syscall(SYS_gettid);
+
+		if (prio == TPRIO_BACKGROUND) {
+			sched_param param = {};
+			param.sched_priority = 0;
+			if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0)
+				return;
+			// SCHED_IDLE not allowed (should always be allowed for normal threads), fall back to max nice
+			setpriority(PRIO_PROCESS, (id_t)tid, 19);
+			return;
+		}
+
+		int nice = 0;
+		switch (prio) {
+			case TPRIO_MAIN:		nice = -10; break;
+			case TPRIO_PARALLELISM:	nice = -5; break;
+			default: break;
+		}
+		setpriority(PRIO_PROCESS, (id_t)tid, nice);
+	}
+
+	static void set_thread_affinity (int core_index, bool exclude) {
+		auto& topo = get_cpu_topology();
+		if (topo.physical_cores <= 1) return;
+		core_index %= topo.physical_cores;
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		int count = 0;
+		for (auto& cpu : topo.cpus) {
+			if ((cpu.core == core_index) != exclude && cpu.id < CPU_SETSIZE) {
+				CPU_SET(cpu.id, &set);
+				count++;
+			}
+		}
+		if (count == 0) return;
+
+		// can fail if restricted by a cpuset (ie. containers), just keep the default affinity
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	// pins the thread to all logical cpus (SMT siblings) of the physical core
+	void set_thread_preferred_core (int preferred_core) {
+		set_thread_affinity(preferred_core, false);
+	}
+	void set_thread_excluded_core (int core_index) {
+		set_thread_affinity(core_index, true);
+	}
+
+	void set_thread_description (std::string_view description) {
+		// linux thread names are limited to 15 chars + null terminator
+		char name[16];
+		size_t len = std::min(description.size(), sizeof(name) -1);
+		memcpy(name, description.data(), len);
+		name[len] = '\0';
+
+		pthread_setname_np(pthread_self(), name);
+	}
+
+	// sysfs files report a bogus size, so read them via fscanf instead of load_text_file
+	static bool read_sysfs_int (char const* path, int* out) {
+		FILE* f = fopen(path, "r");
+		if (!f) return false;
+		bool ok = fscanf(f, "%d", out) == 1;
+		fclose(f);
+		return ok;
+	}
+	// parses cpu lists like "0-3,8-11" and calls func(cpu) for every cpu
+	template <typename FUNC>
+	static bool read_sysfs_cpu_list (char const* path, FUNC func) {
+		FILE* f = fopen(path, "r");
+		if (!f) return false;
+
+		int first, last;
+		while (fscanf(f, "%d", &first) == 1) {
+			last = first;
+			int c = fgetc(f);
+			if (c == '-') {
+				if (fscanf(f, "%d", &last) != 1) break;
+				c = fgetc(f);
+			}
+			for (int i=first; i<=last; ++i)
+				func(i);
+			if (c != ',') break;
+		}
+
+		fclose(f);
+		return true;
+	}
+
+	static CpuTopology detect_cpu_topology () {
+		CpuTopology topo;
+
+		std::vector<int> online;
+		read_sysfs_cpu_list("/sys/devices/system/cpu/online", [&] (int cpu) { online.push_back(cpu); });
+
+		char path[256];
+		for (int id : online) {
+			int core_id = id, package_id = 0;
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", id);
+			read_sysfs_int(path, &core_id);
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", id);
+			read_sysfs_int(path, &package_id);
+
+			// core_id is only unique within a package
+			int core = (package_id << 16) | (core_id & 0xffff);
+
+			// L3 domain identified by the lowest cpu sharing it
+			int l3 = -1;
+			for (int idx=0;; ++idx) {
+				int level;
+				snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", id, idx);
+				if (!read_sysfs_int(path, &level)) break;
+				if (level != 3) continue;
+
+				snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", id, idx);
+				read_sysfs_cpu_list(path, [&] (int cpu) { if (l3 < 0 || cpu < l3) l3 = cpu; });
+				break;
+			}
+
+			topo.cpus.push_back({ id, core, l3 });
+		}
+		return topo;
+	}
+
 #else
 static_assert(false, "implement or dummy prioriy and sheduling handling on other platforms");
 #endif
@@ -1,8 +1,18 @@
 #pragma once
 #include <thread>
+#include <vector>
 #include "macros.hpp"
 #include "threadsafe_queue.hpp"
+#include "threadsafe_ring_queue.hpp"
+#include "threadsafe_priority_queue.hpp"
+#include "work_stealing_deque.hpp"
+#include "task_group.hpp"
+#include "countdown_latch.hpp"
+#include "cancel_token.hpp"
+#include "recycled_job.hpp"
+#include "threadpool_telemetry.hpp"
 #include "string.hpp"
+#include "timer.hpp"
 
 #ifdef TRACY_ENABLE
 	#include "tracy/Tracy.hpp"
@@ -18,6 +28,15 @@ enum ThreadPrio {
 	TPRIO_BACKGROUND,
 };
 
+enum ThreadpoolMode {
+	// all threads pop from the shared jobs queue (one mutex)
+	TPOOL_SHARED_QUEUE,
+	// every thread owns a work-stealing deque, jobs queue acts as the injector for pushes from outside threads
+	// threads take small batches from the injector and steal from each other when they run dry
+	// use when many threads pull lots of small jobs and the jobs queue lock shows up as contention
+	TPOOL_WORK_STEALING,
+};
+
 // std::thread::hardware_concurrency() gets the number of cpu threads
 
 // Is is probaby reasonable to set a game process priority to above_normal, so that background apps don't interfere with the games performance too much,
@@ -29,9 +48,36 @@ void set_process_priority ();
 //  preempting the background threadpool and hopefully being done in time
 void set_thread_priority (ThreadPrio prio);
 
-// Set a desired cpu core for the current thread to run on
+// Cpu topology as reported by the os, used to place threadpool threads on physical cores
+struct CpuTopology {
+	struct LogicalCpu {
+		int id;   // os index of the logical cpu (hardware thread)
+		int core; // index of the physical core, SMT siblings share the same core
+		int l3;   // index of the L3 cache domain (ie. CCX), -1 if unknown
+	};
+	std::vector<LogicalCpu> cpus;
+
+	int physical_cores = 0;
+
+	// physical core indices ordered by distance from MAIN_THREAD_CORE
+	// ie. MAIN_THREAD_CORE first, then the cores sharing it's L3, then the rest
+	std::vector<int> cores_by_locality;
+};
+
+// detected once on first call, falls back to treating every logical cpu as a physical core if the os does not tell us
+CpuTopology const& get_cpu_topology ();
+
+// physical core that is kept free of threadpool threads for the main thread
+// Engine::main_loop pins the main thread to it after starting it's other threads, the render and fixed timestep threads exclude it
+inline constexpr int MAIN_THREAD_CORE = 0;
+
+// Set a desired physical cpu core (index into CpuTopology cores) for the current thread to run on
 void set_thread_preferred_core (int core_index);
 
+// Allow the current thread to run on all physical cores except core_index
+// used to keep background threads from preempting the main thread
+void set_thread_excluded_core (int core_index);
+
 // Set description of current thread (mainly for debugging)
 // allows for easy overview of threads in debugger
 void set_thread_description (std::string_view description);
@@ -41,62 +87,367 @@ void set_thread_description (std::string_view description);
 // threads call Job.execute() and std::move() the return value into threadpool.results
 // threadpool.try_pop() to get results
 // jobs and job results should be default constructable and small and moveable
-template <typename JOB>
+// JOBS_QUEUE and RESULTS_QUEUE can be swapped for ThreadsafeRingQueue to get allocation-free lock-free hand-off
+//  (at the cost of a fixed capacity and no iterate_queue/remove_if/sort), eg. Threadpool<Job, ThreadsafeQueue, ThreadsafeRingQueue>
+//  note that threads block once a bounded results queue is full, so make it's capacity fit the results you let pile up (results.resize())
+//  flush() and shutdown() still work with a full results queue, they drop the results of the blocked threads
+// JOBS_QUEUE = ThreadsafePriorityQueue lets you push jobs with a priority and update it while queued (jobs.push(job, prio) returns a handle)
+// JOB can optionally have a 'CountdownLatch* latch' member, which is counted down after the job's result was pushed
+//  so that waiting for a batch of jobs costs a single wakeup (jobs dropped by flush() or shutdown() never count down)
+// JOB can optionally have a 'CancelToken cancel_token' member, cancelled jobs are not executed and never show up in results
+//  (a job cancelled while executing finishes, but it's result is dropped; long jobs can poll cancel_token.is_cancelled() to stop early)
+// derive JOB from RecycledJob<JOB> to avoid a malloc/free per job
+// with THREADPOOL_TELEMETRY=1 threadpool.telemetry records queue wait and run time per job type and busy/idle time per thread
+template <typename JOB,
+          template <typename> typename JOBS_QUEUE = ThreadsafeQueue,
+          template <typename> typename RESULTS_QUEUE = ThreadsafeQueue>
 class Threadpool {
 	NO_MOVE_COPY_CLASS(Threadpool)
 
 	std::vector< std::thread >	threads;
 
-	void thread_main (std::string thread_name, ThreadPrio prio/*, int preferred_core*/) { // thread_name mainly for debugging
+	// TPOOL_WORK_STEALING only, one deque per thread, owned jobs are stored as raw pointers
+	std::unique_ptr< WorkStealingDeque<JOB*>[] > deques;
+	int							deque_count = 0;
+	// number of threads sleeping on the jobs queue
+	// pushed tasks only need to wake threads if there are any, and jobs are only kept thread-local while nobody is sleeping
+	std::atomic<int>			sleeping = 0;
+
+	// max number of jobs taken from the jobs queue at once in TPOOL_WORK_STEALING mode
+	// the remaining jobs go into the local deque where they can be stolen
+	static constexpr size_t INJECTOR_BATCH = 8;
+
+	static inline thread_local Threadpool* _cur_pool = nullptr;
+	static inline thread_local int         _cur_thread_idx = -1;
+
+	// flush() bumps flush_epoch, every thread acks by decrementing flush_pending once it is between jobs
+	// and then waits for flush_done to reach the epoch, while flush() drops the queued jobs and results
+	std::atomic<uint32_t>		flush_epoch = 0;
+	std::atomic<uint32_t>		flush_done = 0;
+	std::atomic<int>			flush_pending = 0;
+
+	// set by shutdown(), so that threads blocked on a full bounded results queue give up on their result
+	std::atomic<bool>			stopping = false;
+
+	void _flush_barrier (uint32_t epoch) {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::flush barrier");
+
+		if (flush_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			flush_pending.notify_all();
+
+		for (;;) {
+			uint32_t done = flush_done.load(std::memory_order_acquire);
+			if (done == epoch)
+				return;
+			flush_done.wait(done, std::memory_order_acquire);
+		}
+	}
+
+	void thread_main (std::string thread_name, ThreadPrio prio, int thread_idx, int preferred_core, uint32_t seen_epoch) { // thread_name mainly for debugging
 		set_thread_priority(prio);
 
-		//set_thread_preferred_core(preferred_core);
+		if (preferred_core >= 0)
+			set_thread_preferred_core(preferred_core);
+		else if (prio == TPRIO_BACKGROUND && get_cpu_topology().physical_cores > 1)
+			set_thread_excluded_core(MAIN_THREAD_CORE);
+
 		set_thread_description(thread_name);
 
+		_cur_pool = this;
+		_cur_thread_idx = thread_idx;
+
+		uint64_t rand_state = 0x9E3779B97F4A7C15ull * (uint64_t)(thread_idx + 1);
 		// Wait for one job to pop and execute or until shutdown signal is sent via jobs.shutdown()
 		for (;;) {
+			uint32_t epoch = flush_epoch.load(std::memory_order_acquire);
+			if (epoch != seen_epoch) {
+				seen_epoch = epoch;
+				_flush_barrier(epoch);
+			}
+
+			// tasks are small and usually waited on this frame, so run them before jobs
+		#if THREADPOOL_TELEMETRY
+			uint64_t task_start = kiss::get_timestamp();
+			if (tasks.try_run_one() || _try_run_resume()) {
+				telemetry.record_busy(thread_idx, kiss::get_timestamp() - task_start);
+				continue;
+			}
+		#else
+			if (tasks.try_run_one() || _try_run_resume())
+				continue;
+		#endif
+
 			std::unique_ptr<JOB> job;
-			if (jobs.pop_or_shutdown_wait(&job) == decltype(jobs)::SHUTDOWN)
-				return;
+		#if THREADPOOL_TELEMETRY
+			// only a pop of the jobs queue below may set this, not the _resumes_overflow pop above or ThreadsafeQueues used by the last job
+			_threadpool_popped_enqueue_ts = 0;
+		#endif
+			if (!_find_work(thread_idx, rand_state, &job)) {
+				sleeping.fetch_add(1);
+				std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in PoolTaskQueue::push and push_resume
+
+			#if THREADPOOL_TELEMETRY
+				uint64_t idle_start = kiss::get_timestamp();
+			#endif
+				auto res = jobs.pop_or_shutdown_wait(&job, [this, seen_epoch] () {
+					return !tasks.empty() || !resumes.empty() || _resumes_overflow_count.load(std::memory_order_relaxed) > 0
+						|| flush_epoch.load(std::memory_order_relaxed) != seen_epoch;
+				});
+			#if THREADPOOL_TELEMETRY
+				telemetry.record_idle(thread_idx, kiss::get_timestamp() - idle_start);
+			#endif
+				sleeping.fetch_sub(1);
+
+				if (res == decltype(jobs)::SHUTDOWN)
+					return;
+				if (res == decltype(jobs)::WOKEN)
+					continue; // tasks were pushed or flush() was called
+			}
+
+			_run_job(std::move(job), thread_idx);
+		}
+	}
 
-			job->execute();
+	// resumed coroutines only ever run here, never on threads that just help out (TaskGroup::wait, contribute_work)
+	bool _try_run_resume () {
+		if (resumes.try_run_one())
+			return true;
+		if (_resumes_overflow_count.load(std::memory_order_relaxed) <= 0)
+			return false;
+
+		PoolTask task;
+		if (!_resumes_overflow.try_pop(&task))
+			return false;
+		_resumes_overflow_count.fetch_sub(1, std::memory_order_relaxed);
+		task.run();
+		return true;
+	}
+
+	static bool _is_cancelled (JOB& job) {
+		if constexpr (requires (JOB& j) { { j.cancel_token.is_cancelled() } -> std::convertible_to<bool>; })
+			return job.cancel_token.is_cancelled();
+		else
+			return false;
+	}
+
+	// a bounded RESULTS_QUEUE (ie. ThreadsafeRingQueue) blocks the push while it is full
+	// that wait is interrupted by flush() and shutdown(), which could otherwise never get the thread to ack the flush or join it
+	// (flush_pending > 0 while a flush waits for threads that did not ack yet, which includes us)
+	// returns false if the result was dropped
+	bool _push_result (std::unique_ptr<JOB>& job) {
+		if constexpr (requires { results.wake_producers(); }) {
+			return results.push_or_wake_wait(job, [this] () {
+				return stopping.load(std::memory_order_relaxed) || flush_pending.load(std::memory_order_relaxed) > 0;
+			});
+		}
+		else {
 			results.push(std::move(job));
+			return true;
+		}
+	}
+	void _wake_result_producers () {
+		if constexpr (requires { results.wake_producers(); })
+			results.wake_producers();
+	}
+
+	// thread_idx -1 if not called from a thread of this pool
+	void _run_job (std::unique_ptr<JOB> job, int thread_idx) {
+		CountdownLatch* latch = nullptr;
+		if constexpr (requires (JOB& j) { { j.latch } -> std::convertible_to<CountdownLatch*>; })
+			latch = job->latch;
+
+	#if THREADPOOL_TELEMETRY
+		// set by the jobs queue pop, 0 for jobs that came from a deque
+		uint64_t enqueue_ts = _threadpool_popped_enqueue_ts;
+		_threadpool_popped_enqueue_ts = 0;
+	#else
+		(void)thread_idx;
+	#endif
+
+		if (!_is_cancelled(*job)) {
+		#if THREADPOOL_TELEMETRY
+			auto& type = typeid(*job); // dynamic type if JOB is polymorphic
+			uint64_t start_ts = kiss::get_timestamp();
+			job->execute();
+			telemetry.record_job(thread_idx, type, enqueue_ts, start_ts, kiss::get_timestamp());
+		#else
+			job->execute();
+		#endif
+
+			if (!_is_cancelled(*job) && !_push_result(job))
+				job = nullptr; // dropped while waiting for space in results
+		}
+
+		if (job) {
+			// cancelled, just drop it
+			cancelled_jobs.fetch_add(1, std::memory_order_relaxed);
+			job = nullptr;
+		}
+
+		// after the push, so the result is available once the latch is done
+		// cancelled jobs still count down, so nobody waits forever
+		if (latch)
+			latch->count_down();
+	}
+
+	// TPOOL_SHARED_QUEUE: simply try the jobs queue
+	// TPOOL_WORK_STEALING: own deque first, then steal from random threads, then take a batch from the jobs queue
+	bool _find_work (int thread_idx, uint64_t& rand_state, std::unique_ptr<JOB>* out) {
+		if (mode != TPOOL_WORK_STEALING)
+			return jobs.try_pop(out);
+
+		JOB* ptr;
+		if (deques[thread_idx].pop(&ptr)) {
+			out->reset(ptr);
+			return true;
+		}
+
+		int count = deque_count;
+		if (count > 1) {
+			// xorshift
+			rand_state ^= rand_state << 13;
+			rand_state ^= rand_state >> 7;
+			rand_state ^= rand_state << 17;
+
+			int start = (int)(rand_state % (uint64_t)count);
+			for (int i=0; i<count; ++i) {
+				int victim = (start + i) % count;
+				if (victim != thread_idx && deques[victim].steal(&ptr)) {
+					out->reset(ptr);
+					return true;
+				}
+			}
 		}
+
+		// only batch when nobody is sleeping, else the batch would sit in our deque while other threads sleep
+		size_t max = sleeping.load(std::memory_order_relaxed) == 0 ? INJECTOR_BATCH : 1;
+
+		std::unique_ptr<JOB> batch[INJECTOR_BATCH];
+		size_t n = jobs.pop_n(batch, max);
+		if (n == 0)
+			return false;
+
+		// push in reverse so that we pop them in the original order (jobs queue might be sorted by priority)
+		// while thieves take the least urgent ones first
+		for (size_t i=n-1; i>0; --i)
+			deques[thread_idx].push(batch[i].release());
+
+		*out = std::move(batch[0]);
+		return true;
 	}
 
+	ThreadpoolMode mode = TPOOL_SHARED_QUEUE;
 	std::string thread_base_name;
 	ThreadPrio prio;
 
 public:
 	// jobs.push(Job) to queue work to be executed by a thread
-	ThreadsafeQueue<std::unique_ptr<JOB>> jobs;
+	JOBS_QUEUE<std::unique_ptr<JOB>> jobs;
 	// jobs.try_pop(Job) to dequeue the results of the jobs
-	ThreadsafeQueue<std::unique_ptr<JOB>> results;
+	RESULTS_QUEUE<std::unique_ptr<JOB>> results;
+
+	// tasks run by TaskGroup and parallel_for, threads run these before jobs
+	PoolTaskQueue tasks;
+
+	// coroutines continued on this pool by co_await kiss::resume_on(pool), push with push_resume()
+	// separate from tasks, since TaskGroup::wait and contribute_work run tasks on the calling thread (ie. the main thread)
+	// while only threads of the pool run these
+	PoolTaskQueue resumes;
+	// resumes that did not fit into the resumes ring, rare, so a locked queue is fine
+	ThreadsafeQueue<PoolTask>	_resumes_overflow;
+	std::atomic<int>			_resumes_overflow_count = 0;
+
+#if THREADPOOL_TELEMETRY
+	// telemetry.snapshot() to display or log
+	ThreadpoolTelemetry telemetry;
+#endif
 
 	// don't start threads
-	Threadpool () {}
+	Threadpool () {
+		_init_tasks();
+	}
 	// start thread_count threads
-	Threadpool (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>") {
-		start_threads(thread_count, prio, std::move(thread_base_name));
+	Threadpool (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>", ThreadpoolMode mode=TPOOL_SHARED_QUEUE) {
+		_init_tasks();
+		start_threads(thread_count, prio, std::move(thread_base_name), mode);
+	}
+
+	void _init_tasks () {
+		tasks.wake_ctx = this;
+		tasks.wake_threads = [] (void* ctx) {
+			((Threadpool*)ctx)->_wake_sleeping();
+		};
+		resumes.wake_ctx = this;
+		resumes.wake_threads = tasks.wake_threads;
+	}
+
+	// called after pushing tasks or resumes, after a seq_cst fence that pairs with the one in thread_main
+	void _wake_sleeping () {
+		if (sleeping.load(std::memory_order_relaxed) > 0)
+			jobs.wake_waiters();
 	}
 
 	// start thread_count threads
-	void start_threads (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>") {
+	void start_threads (int thread_count, ThreadPrio prio, std::string thread_base_name="<threadpool>", ThreadpoolMode mode=TPOOL_SHARED_QUEUE) {
 		THREADPOOL_PROFILER_SCOPED("Threadpool::start_threads");
 		
-		//// Threadpools are ideally used with  thread_count <= cpu_core_count  to make use of the cpu without the threads preempting each other (although I don't check the thread count)
-		//// I'm just assuming for now that with  high_prio==false -> thread_count==cpu_core_count -> ie. set each threads affinity to one of the cores
-		////  and with high_prio==true you leave at least one core free for the main thread, so we assign the cores 1-n to the threads so that the main thread can be on core 0
-		//int cpu_core = prio == ThreadPriority::HIGH ? 1 : 0;
+		// Threadpools are ideally used with  thread_count <= cpu_core_count  to make use of the cpu without the threads preempting each other (although I don't check the thread count)
+		// TPRIO_PARALLELISM threads get pinned to one physical core each, skipping MAIN_THREAD_CORE and preferring cores that share it's L3
+		//  so that the main thread can be on core 0 and work on the same data as the threads
+		// TPRIO_BACKGROUND threads can run anywhere but MAIN_THREAD_CORE (see thread_main)
+		auto& topo = get_cpu_topology();
+		int free_cores = topo.physical_cores - 1;
+
+	#if THREADPOOL_TELEMETRY
+		telemetry.init_workers(thread_count);
+	#endif
+
+		this->mode = mode;
+		if (mode == TPOOL_WORK_STEALING) {
+			deques = std::make_unique< WorkStealingDeque<JOB*>[] >(thread_count);
+			deque_count = thread_count;
+		}
+
+		// passed to threads instead of them reading it on startup, so a flush() right after start_threads does not miss them
+		uint32_t epoch = flush_epoch.load(std::memory_order_relaxed);
 
 		for (int i=0; i<thread_count; ++i) {
-			threads.emplace_back( &Threadpool::thread_main, this, kiss::prints("%s #%d", thread_base_name.c_str(), i), prio/*, cpu_core++*/);
+			int preferred_core = -1;
+			if (prio == TPRIO_PARALLELISM && free_cores > 0)
+				preferred_core = topo.cores_by_locality[1 + i % free_cores];
+
+			threads.emplace_back( &Threadpool::thread_main, this, kiss::prints("%s #%d", thread_base_name.c_str(), i), prio, i, preferred_core, epoch);
 		}
 
 		this->thread_base_name = std::move(thread_base_name);
 		this->prio = prio;
 	}
 
+	// queue a job, can be called from any thread
+	// when called from inside a job of this threadpool in TPOOL_WORK_STEALING mode the job goes into the threads own deque
+	// which avoids the jobs queue lock, otherwise same as jobs.push()
+	void spawn (std::unique_ptr<JOB> job) {
+		if (mode == TPOOL_WORK_STEALING && _cur_pool == this && sleeping.load(std::memory_order_relaxed) == 0) {
+			deques[_cur_thread_idx].push(job.release());
+			return;
+		}
+		jobs.push(std::move(job));
+	}
+
+	// queue a task (usually a coroutine resume) that only threads of this pool may run, can be called from any thread
+	// never runs the task on the calling thread, tasks that don't fit into the resumes ring go into a locked overflow queue
+	// the pool needs at least one thread for these to ever run
+	void push_resume (PoolTask& task) {
+		if (resumes.push(task))
+			return;
+
+		_resumes_overflow.push(std::move(task));
+		_resumes_overflow_count.fetch_add(1, std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in thread_main
+		_wake_sleeping();
+	}
+
 	// can be called from the producer thread to work on the jobs itself
 	// useful when the producer needs to wait for the jobs to be done anyway
 	// returns when jobs queue is empty, ie. all jobs are being processed
@@ -111,45 +462,156 @@ public:
 			for (i in range jobs.count())
 				res = threadpool.results.pop()
 	*/
+	// for simple loops prefer parallel_for, which needs no job allocations
 	void contribute_work () {
 		THREADPOOL_PROFILER_SCOPED("Threadpool::contribute_work");
 
-		// Wait for one job to pop and execute or until shutdown signal is sent via jobs.shutdown()
 		for (;;) {
-			JOB job;
+			if (tasks.try_run_one())
+				continue;
+
+			std::unique_ptr<JOB> job;
+		#if THREADPOOL_TELEMETRY
+			_threadpool_popped_enqueue_ts = 0; // see thread_main
+		#endif
 			if (!jobs.try_pop(&job))
 				return;
 
-			job.execute();
-			results.push(std::move(job));
+			_run_job(std::move(job), -1);
 		}
 	}
 
+	// call func(i) for all i in [begin, end) using the threads of this pool and the calling thread
+	// indices are handed out in chunks of grain, choose grain so that one chunk is worth a few microseconds of work
+	// returns once all iterations are done
+	/* pattern:
+		threadpool.parallel_for(0, (int)entities.size(), 64, [&] (int i) {
+			entities[i].update(dt);
+		});
+	*/
+	template <typename FUNC>
+	void parallel_for (int begin, int end, int grain, FUNC func) {
+		THREADPOOL_PROFILER_SCOPED("Threadpool::parallel_for");
+
+		if (end <= begin)
+			return;
+		if (grain < 1)
+			grain = 1;
+
+		int chunks = (end - begin + grain - 1) / grain;
+		int helpers = std::min(chunks - 1, thread_count());
+
+		if (helpers <= 0) {
+			for (int i=begin; i<end; ++i)
+				func(i);
+			return;
+		}
+
+		// every participating thread grabs chunks until none are left, which balances uneven chunks automatically
+		std::atomic<int> next = begin;
+		auto work = [&next, &func, end, grain] () {
+			for (;;) {
+				int i0 = next.fetch_add(grain, std::memory_order_relaxed);
+				if (i0 >= end)
+					return;
+				int i1 = std::min(i0 + grain, end);
+				for (int i=i0; i<i1; ++i)
+					func(i);
+			}
+		};
+
+		TaskGroup group(tasks);
+		for (int i=0; i<helpers; ++i)
+			group.run(work);
+
+		work();
+
+		group.wait();
+	}
+
 	// optional manual shutdown
 	void shutdown () {
 		THREADPOOL_PROFILER_SCOPED("Threadpool::shutdown");
 
-		if (!threads.empty())
+		if (!threads.empty()) {
+			stopping.store(true, std::memory_order_relaxed);
 			jobs.shutdown(); // set shutdown to all threads
+			_wake_result_producers();
+		}
 
 		for (auto& t : threads)
 			t.join(); // wait for all threads to exit thread_main
 
 		jobs.reset_shutdown();
+		stopping.store(false, std::memory_order_relaxed);
+
+		// threads are joined, so it's safe to pop other threads deques here
+		_clear_deques();
+		deques = nullptr;
+		deque_count = 0;
 
 		threads.clear();
 		jobs.clear();
 		results.clear();
 	}
 
+	// only call while no thread touches the deques
+	void _clear_deques () {
+		for (int i=0; i<deque_count; ++i) {
+			JOB* ptr;
+			while (deques[i].pop(&ptr))
+				delete ptr;
+		}
+	}
+
+	// number of jobs dropped because their cancel_token was cancelled, for debugging
+	std::atomic<uint64_t> cancelled_jobs = 0;
+
+	// time the last flush() took in seconds, mostly spent waiting for in-flight jobs to finish
+	float last_flush_time = 0;
+
+	// drop all queued jobs and all results, waits for jobs that are currently executing
+	// threads stay alive, they just pause between jobs until the queues are cleared
+	// only call from the thread that owns the threadpool (not from inside jobs or tasks)
 	void flush () {
-		// TODO: could not find a better way of doing this yet. simply restart the threads for now
+		THREADPOOL_PROFILER_SCOPED("Threadpool::flush");
+		auto timer = kiss::Timer::start();
 
-		int thread_count = (int)threads.size();
+		// drop queued jobs early so that the threads don't start them while we wait
+		jobs.clear();
 
-		shutdown();
+		if (!threads.empty()) {
+			flush_pending.store((int)threads.size(), std::memory_order_relaxed);
+			uint32_t epoch = flush_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+			// threads sleeping on the jobs queue see the new epoch through their wake callback
+			jobs.wake_waiters();
+			// threads blocked on a full bounded results queue drop their result and ack
+			_wake_result_producers();
+
+			for (;;) {
+				int pending = flush_pending.load(std::memory_order_acquire);
+				if (pending <= 0)
+					break;
+				flush_pending.wait(pending, std::memory_order_acquire);
+			}
+
+			// all threads wait in _flush_barrier, nothing can push jobs or results now
+			_clear_deques();
+			jobs.clear();
+			results.clear();
+
+			flush_done.store(epoch, std::memory_order_release);
+			flush_done.notify_all();
+		}
+		else {
+			results.clear();
+		}
 
-		start_threads(thread_count, prio, std::move(thread_base_name));
+		last_flush_time = timer.end();
+	#ifdef TRACY_ENABLE
+		TracyPlot("Threadpool flush ms", last_flush_time * 1000.0f);
+	#endif
 	}
 
 	~Threadpool () {
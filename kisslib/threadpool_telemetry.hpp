@@ -0,0 +1,177 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <typeinfo>
+#include "stdint.h"
+#include "macros.hpp"
+#include "timer.hpp"
+
+// Compile with THREADPOOL_TELEMETRY=1 to record how long jobs wait in the queue and how long they run, and how busy each thread is
+// with THREADPOOL_TELEMETRY=0 (default) none of this is compiled into Threadpool or ThreadsafeQueue
+#ifndef THREADPOOL_TELEMETRY
+	#define THREADPOOL_TELEMETRY 0
+#endif
+
+#if THREADPOOL_TELEMETRY
+// set by ThreadsafeQueue pops to the timestamp of when the popped element was pushed (0 if unknown, ie. other queue types)
+// for batch pops this is the timestamp of the oldest element
+inline thread_local uint64_t _threadpool_popped_enqueue_ts = 0;
+
+// lock-free recording of job timings, read via snapshot()
+class ThreadpoolTelemetry {
+	NO_MOVE_COPY_CLASS(ThreadpoolTelemetry)
+public:
+	// log2 buckets of microseconds: bucket 0: < 1us, 1: < 2us, 2: < 4us ... last bucket: everything above
+	static constexpr int BUCKETS = 24;
+	// max number of distinct job types (only >1 if JOB is polymorphic), further types are counted as the last one
+	static constexpr int MAX_TYPES = 16;
+
+	struct Histogram {
+		std::atomic<uint32_t> buckets[BUCKETS] = {};
+		std::atomic<uint64_t> total_ticks = 0;
+		std::atomic<uint64_t> count = 0;
+
+		void record (uint64_t ticks) {
+			uint64_t us = ticks * 1000000 / kiss::timestamp_freq;
+			int bucket = 0;
+			while (us > 0 && bucket < BUCKETS-1) {
+				us >>= 1;
+				bucket++;
+			}
+			buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+			total_ticks.fetch_add(ticks, std::memory_order_relaxed);
+			count.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	struct JobType {
+		std::atomic<std::type_info const*> type = nullptr;
+		Histogram wait; // time from push to start of execution
+		Histogram run;  // execution time
+	};
+
+	// written only by the owning thread, padded to avoid false sharing
+	struct alignas(64) Worker {
+		std::atomic<uint64_t> busy_ticks = 0; // running jobs and tasks
+		std::atomic<uint64_t> idle_ticks = 0; // sleeping on the jobs queue
+		std::atomic<uint64_t> jobs = 0;
+	};
+
+private:
+	std::unique_ptr<Worker[]>	workers;
+	int							worker_count = 0;
+	JobType						types[MAX_TYPES];
+
+	JobType& _get_type (std::type_info const& type) {
+		for (int i=0; i<MAX_TYPES-1; ++i) {
+			auto* t = types[i].type.load(std::memory_order_acquire);
+			if (t == nullptr) {
+				// claim slot, another thread might claim it at the same time for a different type
+				if (types[i].type.compare_exchange_strong(t, &type, std::memory_order_acq_rel))
+					return types[i];
+			}
+			if (t == &type || (t && *t == type))
+				return types[i];
+		}
+		return types[MAX_TYPES-1];
+	}
+
+public:
+	ThreadpoolTelemetry () {}
+
+	// not threadsafe, called by Threadpool::start_threads
+	void init_workers (int count) {
+		workers = std::make_unique<Worker[]>(count);
+		worker_count = count;
+	}
+
+	// thread_idx -1 for jobs run via contribute_work
+	void record_job (int thread_idx, std::type_info const& type, uint64_t enqueue_ts, uint64_t start_ts, uint64_t end_ts) {
+		auto& t = _get_type(type);
+		if (enqueue_ts != 0 && enqueue_ts <= start_ts)
+			t.wait.record(start_ts - enqueue_ts);
+		t.run.record(end_ts - start_ts);
+
+		if (thread_idx >= 0) {
+			workers[thread_idx].busy_ticks.fetch_add(end_ts - start_ts, std::memory_order_relaxed);
+			workers[thread_idx].jobs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	void record_busy (int thread_idx, uint64_t ticks) {
+		workers[thread_idx].busy_ticks.fetch_add(ticks, std::memory_order_relaxed);
+	}
+	void record_idle (int thread_idx, uint64_t ticks) {
+		workers[thread_idx].idle_ticks.fetch_add(ticks, std::memory_order_relaxed);
+	}
+
+	// plain copy of the counters for displaying or logging, values are totals since start (or reset)
+	struct Snapshot {
+		struct WorkerStats {
+			float	busy_sec;
+			float	idle_sec;
+			uint64_t jobs;
+
+			float utilization () const { return busy_sec + idle_sec > 0 ? busy_sec / (busy_sec + idle_sec) : 0; }
+		};
+		struct HistogramStats {
+			uint32_t buckets[BUCKETS];
+			uint64_t count;
+			float    avg_sec;
+		};
+		struct JobTypeStats {
+			char const*		name; // implementation defined (typeid().name())
+			HistogramStats	wait;
+			HistogramStats	run;
+		};
+
+		std::vector<WorkerStats>	workers;
+		std::vector<JobTypeStats>	job_types;
+	};
+
+	Snapshot snapshot () const {
+		auto hist = [] (Histogram const& h) {
+			Snapshot::HistogramStats s;
+			for (int i=0; i<BUCKETS; ++i)
+				s.buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+			s.count = h.count.load(std::memory_order_relaxed);
+			uint64_t total = h.total_ticks.load(std::memory_order_relaxed);
+			s.avg_sec = s.count ? (float)total / (float)kiss::timestamp_freq / (float)s.count : 0;
+			return s;
+		};
+
+		Snapshot snap;
+		for (int i=0; i<worker_count; ++i) {
+			auto& w = workers[i];
+			snap.workers.push_back({
+				(float)w.busy_ticks.load(std::memory_order_relaxed) / (float)kiss::timestamp_freq,
+				(float)w.idle_ticks.load(std::memory_order_relaxed) / (float)kiss::timestamp_freq,
+				w.jobs.load(std::memory_order_relaxed),
+			});
+		}
+		for (auto& t : types) {
+			auto* type = t.type.load(std::memory_order_acquire);
+			if (!type) continue;
+			snap.job_types.push_back({ type->name(), hist(t.wait), hist(t.run) });
+		}
+		return snap;
+	}
+
+	// reset counters, can race with threads recording, so a few samples might be lost or end up in the next period
+	void reset () {
+		for (int i=0; i<worker_count; ++i) {
+			workers[i].busy_ticks.store(0, std::memory_order_relaxed);
+			workers[i].idle_ticks.store(0, std::memory_order_relaxed);
+			workers[i].jobs.store(0, std::memory_order_relaxed);
+		}
+		for (auto& t : types) {
+			for (auto* h : { &t.wait, &t.run }) {
+				for (auto& b : h->buckets)
+					b.store(0, std::memory_order_relaxed);
+				h->total_ticks.store(0, std::memory_order_relaxed);
+				h->count.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,395 @@
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
+#include "stdint.h"
+#include "assert.h"
+
+#include "tracy/Tracy.hpp"
+#ifdef TRACY_ENABLE
+	// Need to wrap locks for tracy
+	#define MUTEX				TracyLockableN(std::mutex,	m, "ThreadsafePriorityQueue mutex")
+	#define CONDITION_VARIABLE	std::condition_variable_any	c
+
+	#define UNIQUE_LOCK			std::unique_lock<LockableBase(std::mutex)> lock(m)
+	#define LOCK_GUARD			std::lock_guard<LockableBase(std::mutex)> lock(m)
+#else
+	#define MUTEX				std::mutex m
+	#define CONDITION_VARIABLE	std::condition_variable_any	c
+
+	#define UNIQUE_LOCK			std::unique_lock lock(m)
+	#define LOCK_GUARD			std::lock_guard lock(m)
+#endif
+
+// multiple producer multiple consumer threadsafe priority queue with T items
+// pops always return the item with the lowest priority value (ie. use distance to camera directly), equal priorities pop in push order
+// push() returns a Handle that can be used to update the priority of a queued item in O(log n) or to remove it
+// instead of sorting a whole ThreadsafeQueue every frame either update() individual items or update_all() which rebuilds the heap in O(n)
+// has the same push/pop interface as ThreadsafeQueue, so it can be used as JOBS_QUEUE of a Threadpool, eg. Threadpool<Job, ThreadsafePriorityQueue>
+//  (pushes without priority use PRIO{})
+template <typename T, typename PRIO=float>
+class ThreadsafePriorityQueue {
+public:
+	// stays valid until the item is popped or removed, after that update() and remove() simply return false
+	struct Handle {
+		uint32_t slot = (uint32_t)-1;
+		uint32_t generation = 0;
+	};
+
+private:
+	MUTEX;
+	CONDITION_VARIABLE;
+
+	// heap only moves these small nodes around, items stay in their slot
+	struct Node {
+		PRIO		prio;
+		uint64_t	order; // push order to break ties
+		uint32_t	slot;
+	};
+	struct Slot {
+		T			val;
+		uint32_t	heap_idx; // == -1 if free
+		uint32_t	generation = 0;
+	};
+
+	std::vector<Node>		heap;
+	std::vector<Slot>		slots;
+	std::vector<uint32_t>	free_slots;
+	uint64_t				next_order = 0;
+
+	// use is optional (makes sense to use this to stop threads of thread pools (ie. use this on the job queue), but does not make sense to use this on the results queue)
+	bool					shutdown_flag = false;
+
+	static bool _before (Node const& l, Node const& r) {
+		if (l.prio != r.prio) return l.prio < r.prio;
+		return l.order < r.order;
+	}
+
+	void _set (uint32_t idx, Node const& node) {
+		heap[idx] = node;
+		slots[node.slot].heap_idx = idx;
+	}
+
+	void _sift_up (uint32_t idx) {
+		Node node = heap[idx];
+		while (idx > 0) {
+			uint32_t parent = (idx - 1) / 2;
+			if (!_before(node, heap[parent]))
+				break;
+			_set(idx, heap[parent]);
+			idx = parent;
+		}
+		_set(idx, node);
+	}
+	void _sift_down (uint32_t idx) {
+		Node node = heap[idx];
+		uint32_t count = (uint32_t)heap.size();
+		for (;;) {
+			uint32_t child = idx * 2 + 1;
+			if (child >= count)
+				break;
+			if (child + 1 < count && _before(heap[child + 1], heap[child]))
+				child++;
+			if (!_before(heap[child], node))
+				break;
+			_set(idx, heap[child]);
+			idx = child;
+		}
+		_set(idx, node);
+	}
+
+	bool _valid (Handle h) const {
+		return h.slot < slots.size() && slots[h.slot].generation == h.generation && slots[h.slot].heap_idx != (uint32_t)-1;
+	}
+
+	Handle _push (T&& elem, PRIO prio) {
+		uint32_t slot;
+		if (!free_slots.empty()) {
+			slot = free_slots.back();
+			free_slots.pop_back();
+		} else {
+			slot = (uint32_t)slots.size();
+			slots.emplace_back();
+		}
+
+		slots[slot].val = std::move(elem);
+
+		heap.push_back({ prio, next_order++, slot });
+		_sift_up((uint32_t)heap.size() - 1);
+
+		return { slot, slots[slot].generation };
+	}
+
+	// remove node at heap index idx and move it's item into out
+	void _remove_at (uint32_t idx, T* out) {
+		uint32_t slot = heap[idx].slot;
+
+		Node last = heap.back();
+		heap.pop_back();
+		if (idx < heap.size()) {
+			_set(idx, last);
+			// last node can need to move in either direction
+			_sift_up(idx);
+			_sift_down(slots[last.slot].heap_idx);
+		}
+
+		*out = std::move(slots[slot].val);
+		slots[slot].val = T();
+		slots[slot].heap_idx = (uint32_t)-1;
+		slots[slot].generation++; // invalidates handles
+		free_slots.push_back(slot);
+	}
+
+	void _pop (T* out) {
+		_remove_at(0, out);
+	}
+
+	void _heapify () {
+		if (heap.size() < 2) return;
+		for (uint32_t i=(uint32_t)heap.size()/2; i-- > 0;)
+			_sift_down(i);
+	}
+
+public:
+	// push one element onto the queue with the given priority
+	Handle push (T elem, PRIO prio) {
+		Handle h;
+		{
+			LOCK_GUARD;
+			h = _push(std::move(elem), prio);
+		}
+		// do notify outside of loop to avoid threads waking up only to see we have still locked the mutex
+		c.notify_one();
+		return h;
+	}
+	// push one element with default priority
+	void push (T elem) {
+		push(std::move(elem), PRIO{});
+	}
+
+	// push multiple elements onto the queue with default priority
+	void push_n (T* elem, size_t count) {
+		{
+			LOCK_GUARD;
+			for (size_t i=0; i<count; ++i)
+				_push(std::move(elem[i]), PRIO{});
+		}
+
+		if (count > 1) {
+			c.notify_all();
+		} else {
+			c.notify_one();
+		}
+	}
+
+	// change the priority of a queued item, returns false if the item was already popped or removed
+	bool update (Handle h, PRIO prio) {
+		LOCK_GUARD;
+
+		if (!_valid(h))
+			return false;
+
+		uint32_t idx = slots[h.slot].heap_idx;
+		PRIO old = heap[idx].prio;
+		heap[idx].prio = prio;
+		if (prio < old) _sift_up(idx);
+		else            _sift_down(idx);
+		return true;
+	}
+
+	// recompute the priority of every queued item with template callback 'PRIO func (T const&)' and rebuild the heap in O(n)
+	// use when most priorities change at once (ie. camera moved)
+	template <typename GET_PRIO>
+	void update_all (GET_PRIO get_prio) {
+		LOCK_GUARD;
+
+		for (auto& node : heap)
+			node.prio = get_prio(slots[node.slot].val);
+		_heapify();
+	}
+
+	// remove a queued item, optionally moving it into out, returns false if the item was already popped or removed
+	bool remove (Handle h, T* out=nullptr) {
+		LOCK_GUARD;
+
+		if (!_valid(h))
+			return false;
+
+		T val;
+		_remove_at(slots[h.slot].heap_idx, &val);
+		if (out) *out = std::move(val);
+		return true;
+	}
+
+	bool contains (Handle h) {
+		LOCK_GUARD;
+		return _valid(h);
+	}
+
+	size_t size () {
+		LOCK_GUARD;
+		return heap.size();
+	}
+	bool empty () {
+		LOCK_GUARD;
+		return heap.empty();
+	}
+
+	// wait to dequeue the best element from the queue
+	// can be called from multiple threads (multiple consumer)
+	T pop_wait () {
+		UNIQUE_LOCK;
+
+		while (heap.empty()) {
+			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		}
+
+		T val;
+		_pop(&val);
+		return val;
+	}
+
+	// deque the best element from the queue if there is one
+	// can be called from multiple threads (multiple consumer)
+	bool try_pop (T* out) {
+		LOCK_GUARD;
+
+		if (heap.empty())
+			return false;
+
+		_pop(out);
+		return true;
+	}
+
+	// dequeue up to max elements (or none) in priority order; never waits
+	// returns the number of elements dequeued
+	size_t pop_n (T output[], size_t max) {
+		LOCK_GUARD;
+
+		size_t count = std::min(heap.size(), max);
+		for (size_t i=0; i<count; ++i)
+			_pop(&output[i]);
+
+		return count;
+	}
+
+	// dequeue all elements (including none) in priority order; never waits
+	// returns the number of elements dequeued
+	size_t pop_all (std::vector<T>* output) {
+		LOCK_GUARD;
+
+		size_t count = heap.size();
+		output->reserve(output->size() + count);
+
+		for (size_t i=0; i<count; ++i) {
+			T val;
+			_pop(&val);
+			output->emplace_back(std::move(val));
+		}
+
+		return count;
+	}
+
+	// wait to dequeue the best element from the queue or until shutdown is set
+	// returns if element was popped or shutdown was set as enum
+	// can be called from multiple threads (multiple consumer)
+	enum PopOrShutdown { POP, SHUTDOWN, WOKEN };
+	PopOrShutdown pop_or_shutdown_wait (T* out) {
+		return pop_or_shutdown_wait(out, [] () { return false; });
+	}
+
+	// like pop_or_shutdown_wait, but also returns WOKEN (without popping) once template callback 'bool wake ()' returns true
+	// wake is checked under the lock, so whoever makes it true needs to call wake_waiters() afterwards
+	template <typename WAKE>
+	PopOrShutdown pop_or_shutdown_wait (T* out, WAKE wake) {
+		UNIQUE_LOCK;
+
+		while(!shutdown_flag && heap.empty()) {
+			if (wake())
+				return WOKEN;
+			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		}
+		if (shutdown_flag)
+			return SHUTDOWN;
+
+		_pop(out);
+		return POP;
+	}
+
+	// wake all threads waiting in pop_or_shutdown_wait so they recheck their wake callback
+	void wake_waiters () {
+		{
+			LOCK_GUARD; // make sure waiters are either before their wake() check or actually waiting
+		}
+		c.notify_all();
+	}
+
+	// set shutdown which all consumers can recieve via pop_or_shutdown
+	void shutdown () {
+		LOCK_GUARD;
+
+		shutdown_flag = true;
+		c.notify_all();
+	}
+	void reset_shutdown () {
+		shutdown_flag = false;
+	}
+
+	// iterate queued items with template callback 'void func (T&)' in no particular order
+	// elements are allowed to be changed, but priorities are not, use update() or update_all() for that
+	template <typename FOREACH>
+	void iterate_queue (FOREACH callback) {
+		LOCK_GUARD;
+
+		for (auto& node : heap)
+			callback(slots[node.slot].val);
+	}
+
+	// remove items if template callback 'bool func (T&)' returns true
+	// useful to be able to cancel queued jobs in a threadpool
+	template <typename NEED_TO_CANCEL>
+	void remove_if (NEED_TO_CANCEL need_to_cancel) {
+		LOCK_GUARD;
+
+		bool removed = false;
+		for (uint32_t i=0; i<(uint32_t)heap.size();) {
+			uint32_t slot = heap[i].slot;
+			if (need_to_cancel(slots[slot].val)) {
+				// remove without sifting, heap is rebuilt afterwards
+				heap[i] = heap.back();
+				heap.pop_back();
+				if (i < heap.size())
+					slots[heap[i].slot].heap_idx = i;
+
+				slots[slot].val = T();
+				slots[slot].heap_idx = (uint32_t)-1;
+				slots[slot].generation++;
+				free_slots.push_back(slot);
+				removed = true;
+			} else {
+				++i;
+			}
+		}
+		if (removed)
+			_heapify();
+	}
+
+	void clear () {
+		LOCK_GUARD;
+
+		for (auto& node : heap) {
+			auto& s = slots[node.slot];
+			s.val = T();
+			s.heap_idx = (uint32_t)-1;
+			s.generation++;
+			free_slots.push_back(node.slot);
+		}
+		heap.clear();
+	}
+};
+
+#undef MUTEX
+#undef CONDITION_VARIABLE
+#undef UNIQUE_LOCK
+#undef LOCK_GUARD
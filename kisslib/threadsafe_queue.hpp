@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <vector>
 #include "stl_extensions.hpp"
+#include "threadpool_telemetry.hpp"
 
 #include "tracy/Tracy.hpp"
 #ifdef TRACY_ENABLE
@@ -31,35 +32,97 @@ class ThreadsafeQueue {
 	MUTEX;
 	CONDITION_VARIABLE;
 
+#if THREADPOOL_TELEMETRY
+	// remember when elements were pushed, so that Threadpool can measure how long jobs waited in the queue
+	struct Entry {
+		T			val;
+		uint64_t	enqueue_ts;
+	};
+	static Entry _entry (T&& val) { return { std::move(val), kiss::get_timestamp() }; }
+	static T& _val (Entry& e) { return e.val; }
+#else
+	typedef T Entry;
+	static T&& _entry (T&& val) { return std::move(val); }
+	static T& _val (T& e) { return e; }
+#endif
+
 	// used like a queue but using a deque to support iteration (a queue is just wrapper around a deque, so it is not less efficient to use a deque over a queue)
-	std::deque<T>			q;
+	std::deque<Entry>		q;
+
+	// pop front element with lock held
+	T _pop_front () {
+	#if THREADPOOL_TELEMETRY
+		_threadpool_popped_enqueue_ts = q.front().enqueue_ts;
+	#endif
+		T val = std::move(_val(q.front()));
+		q.pop_front();
+		return val;
+	}
+	void _pop_front_n (T output[], size_t count) {
+	#if THREADPOOL_TELEMETRY
+		uint64_t oldest_ts = count ? q.front().enqueue_ts : 0;
+	#endif
+		for (size_t i=0; i<count; ++i)
+			output[i] = _pop_front();
+	#if THREADPOOL_TELEMETRY
+		_threadpool_popped_enqueue_ts = oldest_ts;
+	#endif
+	}
 
 	// use is optional (makes sense to use this to stop threads of thread pools (ie. use this on the job queue), but does not make sense to use this on the results queue)
 	bool					shutdown_flag = false;
 
+	// pop_n_wait and pop_all_wait wait on their own condition variable
+	// pushes only notify it once the queue has reached the smallest min any of them is waiting for
+	std::condition_variable_any	c_min;
+	size_t					min_waiting = (size_t)-1;
+
+	// call with lock held, returns true if c_min needs to be notified (after unlocking)
+	bool _reached_min () {
+		if (q.size() < min_waiting)
+			return false;
+		// reset, waiters that are still not satisfied register their min again
+		min_waiting = (size_t)-1;
+		return true;
+	}
+	void _wait_min (std::unique_lock<decltype(m)>& lock, size_t min) {
+		while (q.size() < min) {
+			min_waiting = std::min(min_waiting, min);
+			c_min.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		}
+	}
+
 public:
 	// push one element onto the queue
 	void push (T elem) {
+		bool notify_min;
 		{
 			LOCK_GUARD;
 
-			q.emplace_back( std::move(elem) );
+			q.emplace_back( _entry(std::move(elem)) );
+			notify_min = _reached_min();
 		}
 		
 		// do notify outside of loop to avoid threads waking up only to see we have still locked the mutex
 		c.notify_one();
+		if (notify_min)
+			c_min.notify_all();
 	}
 
 	// push multiple elements onto the queue
 	void push_n (T* elem, size_t count) {
 		ZoneScoped;
+		bool notify_min;
 		{
 			LOCK_GUARD;
 
 			for (size_t i=0; i<count; ++i) {
-				q.emplace_back( std::move(elem[i]) );
+				q.emplace_back( _entry(std::move(elem[i])) );
 			}
+			notify_min = _reached_min();
 		}
+		if (notify_min)
+			c_min.notify_all();
 
 		// do notify outside of loop to avoid threads waking up only to see we have still locked the mutex
 		if (count > 1) {
@@ -80,9 +143,7 @@ public:
 			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
 		}
 
-		T val = std::move(q.front());
-		q.pop_front();
-		return val;
+		return _pop_front();
 	}
 
 	// deque one element from the queue if there is one
@@ -93,30 +154,22 @@ public:
 		if (q.empty())
 			return false;
 
-		*out = std::move(q.front());
-		q.pop_front();
+		*out = _pop_front();
 		return true;
 	}
 
-	// Don't like the fact that thread is woken up just to check a number an go back to sleep potentially lots of times
-	// might as well actually process the result
-	// TODO: find a good way of only waking thread up when desired number of results are done
-#if 1
+	// the waiting thread is only woken once min elements are available (see _reached_min), not on every push
+	// to wait for a known set of jobs of a Threadpool CountdownLatch is usually simpler
+	
 	// wait until min elements are available, then dequeue up to max elements
 	// writes the elements into their repective indicies in output
 	// returns the number of elements dequeued
 	size_t pop_n_wait (T output[], size_t min, size_t max) {
 		UNIQUE_LOCK;
-
-		while (q.size() < min) {
-			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
-		}
+		_wait_min(lock, min);
 
 		size_t count = std::min(q.size(), max);
-		for (size_t i=0; i<count; ++i) {
-			output[i] = std::move(q.front());
-			q.pop_front();
-		}
+		_pop_front_n(output, count);
 
 		return count;
 	}
@@ -125,22 +178,17 @@ public:
 	// returns the number of elements dequeued
 	size_t pop_all_wait (std::vector<T>* output, size_t min) {
 		UNIQUE_LOCK;
-
-		while (q.size() < min) {
-			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
-		}
+		_wait_min(lock, min);
 
 		size_t count = q.size();
 		output->reserve(count);
 
 		for (size_t i=0; i<count; ++i) {
-			output->emplace_back( std::move(q.front()) );
-			q.pop_front();
+			output->emplace_back( _pop_front() );
 		}
 
 		return count;
 	}
-#endif
 
 	// dequeue up to max elements (or none); never waits
 	// writes the elements into their repective indicies in output
@@ -149,10 +197,7 @@ public:
 		LOCK_GUARD;
 
 		size_t count = std::min(q.size(), max);
-		for (size_t i=0; i<count; ++i) {
-			output[i] = std::move(q.front());
-			q.pop_front();
-		}
+		_pop_front_n(output, count);
 
 		return count;
 	}
@@ -166,8 +211,7 @@ public:
 		output->reserve(count);
 
 		for (size_t i=0; i<count; ++i) {
-			output->emplace_back( std::move(q.front()) );
-			q.pop_front();
+			output->emplace_back( _pop_front() );
 		}
 
 		return count;
@@ -176,7 +220,7 @@ public:
 	// wait to dequeue one element from the queue or until shutdown is set
 	// returns if element was popped or shutdown was set as enum
 	// can be called from multiple threads (multiple consumer)
-	enum PopOrShutdown { POP, SHUTDOWN };
+	enum PopOrShutdown { POP, SHUTDOWN, WOKEN };
 	PopOrShutdown pop_or_shutdown_wait (T* out) {
 		UNIQUE_LOCK;
 
@@ -186,11 +230,37 @@ public:
 		if (shutdown_flag)
 			return SHUTDOWN;
 
-		*out = std::move(q.front());
-		q.pop_front();
+		*out = _pop_front();
+		return POP;
+	}
+
+	// like pop_or_shutdown_wait, but also returns WOKEN (without popping) once template callback 'bool wake ()' returns true
+	// wake is checked under the lock, so whoever makes it true needs to call wake_waiters() afterwards
+	// allows threads to sleep on this queue while also waiting for some other kind of work
+	template <typename WAKE>
+	PopOrShutdown pop_or_shutdown_wait (T* out, WAKE wake) {
+		UNIQUE_LOCK;
+
+		while(!shutdown_flag && q.empty()) {
+			if (wake())
+				return WOKEN;
+			c.wait(lock); // release lock as long as the wait and reaquire it afterwards.
+		}
+		if (shutdown_flag)
+			return SHUTDOWN;
+
+		*out = _pop_front();
 		return POP;
 	}
 
+	// wake all threads waiting in pop_or_shutdown_wait so they recheck their wake callback
+	void wake_waiters () {
+		{
+			LOCK_GUARD; // make sure waiters are either before their wake() check or actually waiting
+		}
+		c.notify_all();
+	}
+
 	// set shutdown which all consumers can recieve via pop_or_shutdown
 	void shutdown () {
 		LOCK_GUARD;
@@ -209,7 +279,7 @@ public:
 		LOCK_GUARD;
 
 		for (auto it=q.begin(); it!=q.end(); ++it) {
-			callback(*it);
+			callback(_val(*it));
 		}
 	}
 
@@ -220,7 +290,7 @@ public:
 		LOCK_GUARD;
 
 		for (auto it=q.rbegin(); it!=q.rend(); ++it) {
-			callback(*it);
+			callback(_val(*it));
 		}
 	}
 
@@ -231,7 +301,7 @@ public:
 		LOCK_GUARD;
 
 		for (auto it=q.begin(); it!=q.end();) {
-			if (need_to_cancel(*it)) {
+			if (need_to_cancel(_val(*it))) {
 				it = q.erase(it);
 			} else {
 				++it;
@@ -249,7 +319,7 @@ public:
 	void sort (COMPARATOR cmp) {
 		LOCK_GUARD;
 
-		std::sort(q.begin(), q.end(), cmp);
+		std::sort(q.begin(), q.end(), [&] (Entry& l, Entry& r) { return cmp(_val(l), _val(r)); });
 	}
 };
 
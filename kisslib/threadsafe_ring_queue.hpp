@@ -0,0 +1,277 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+#include "bit_twiddling.hpp"
+
+// based on Dmitry Vyukov's bounded MPMC queue https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+// multiple producer multiple consumer lock-free bounded queue with T items
+// alternative to ThreadsafeQueue with the same push/pop interface (no iteration, remove_if or sort)
+// items live in a fixed ring buffer, so push/pop never allocate and never take a lock
+// threads only block (via atomic wait, ie. futex/WaitOnAddress) when the queue is empty (pop) or full (push)
+template <typename T>
+class ThreadsafeRingQueue {
+	NO_MOVE_COPY_CLASS(ThreadsafeRingQueue)
+
+	struct Cell {
+		// == pos      -> free for the producer that claims pos
+		// == pos+1    -> holds item for the consumer that claims pos
+		std::atomic<size_t>	seq;
+		T					val;
+	};
+
+	// producers and consumers hammer different positions, keep them on seperate cache lines
+	alignas(64) std::atomic<size_t>		enqueue_pos = 0;
+	alignas(64) std::atomic<size_t>		dequeue_pos = 0;
+
+	alignas(64) std::unique_ptr<Cell[]>	cells;
+	size_t								mask;
+
+	// blocking is only done on the slow path
+	// waiters register themselves, and push/pop only touch the event counters if someone is actually waiting
+	alignas(64) std::atomic<uint32_t>	not_empty_event = 0;
+	std::atomic<int>					waiting_consumers = 0;
+	alignas(64) std::atomic<uint32_t>	not_full_event = 0;
+	std::atomic<int>					waiting_producers = 0;
+
+	// use is optional (makes sense to use this to stop threads of thread pools (ie. use this on the job queue), but does not make sense to use this on the results queue)
+	std::atomic<bool>					shutdown_flag = false;
+
+	static void _wake (std::atomic<uint32_t>& event, std::atomic<int>& waiting) {
+		// pairs with the fence in _wait, either the waiter sees our item or we see the waiter
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed) > 0) {
+			event.fetch_add(1, std::memory_order_release);
+			event.notify_all();
+		}
+	}
+	template <typename READY>
+	static void _wait (std::atomic<uint32_t>& event, std::atomic<int>& waiting, READY ready) {
+		waiting.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		uint32_t e = event.load(std::memory_order_acquire);
+		if (!ready())
+			event.wait(e, std::memory_order_acquire); // returns once event changed
+
+		waiting.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// elem is only moved from on success
+	bool _try_push (T& elem) {
+		Cell* cell;
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells[pos & mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+			if (dif == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0) {
+				return false; // full
+			}
+			else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->val = std::move(elem);
+		cell->seq.store(pos + 1, std::memory_order_release);
+
+		_wake(not_empty_event, waiting_consumers);
+		return true;
+	}
+
+public:
+	// capacity is rounded up to a power of two
+	ThreadsafeRingQueue (size_t capacity=4096) {
+		resize(capacity);
+	}
+
+	// not threadsafe, only call while no other thread uses the queue
+	// drops all queued items
+	void resize (size_t capacity) {
+		capacity = (size_t)upper_power_of_two(capacity < 2 ? 2 : capacity);
+
+		cells = std::make_unique<Cell[]>(capacity);
+		mask = capacity - 1;
+
+		for (size_t i=0; i<capacity; ++i)
+			cells[i].seq.store(i, std::memory_order_relaxed);
+
+		enqueue_pos.store(0, std::memory_order_relaxed);
+		dequeue_pos.store(0, std::memory_order_relaxed);
+	}
+
+	size_t capacity () const {
+		return mask + 1;
+	}
+
+	// only a snapshot when used concurrently
+	bool empty () const {
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		size_t seq = cells[pos & mask].seq.load(std::memory_order_acquire);
+		return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
+	}
+	// only a snapshot when used concurrently
+	bool full () const {
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		size_t seq = cells[pos & mask].seq.load(std::memory_order_acquire);
+		return (intptr_t)seq - (intptr_t)pos < 0;
+	}
+
+	// push one element onto the queue if there is space
+	// elem is left untouched if the queue is full
+	bool try_push (T&& elem) {
+		return _try_push(elem);
+	}
+
+	// push one element onto the queue, waits while the queue is full
+	void push (T elem) {
+		while (!_try_push(elem)) {
+			_wait(not_full_event, waiting_producers, [this] () { return !full(); });
+		}
+	}
+
+	// like push, but stops waiting (without pushing) once template callback 'bool wake ()' returns true
+	// returns if elem was pushed, elem is left untouched otherwise
+	// whoever makes wake() true needs to call wake_producers() afterwards
+	template <typename WAKE>
+	bool push_or_wake_wait (T& elem, WAKE wake) {
+		for (;;) {
+			if (_try_push(elem))
+				return true;
+			if (wake())
+				return false;
+
+			_wait(not_full_event, waiting_producers, [&] () { return !full() || wake(); });
+		}
+	}
+
+	// wake all threads waiting in push_or_wake_wait so they recheck their wake callback
+	void wake_producers () {
+		not_full_event.fetch_add(1, std::memory_order_release);
+		not_full_event.notify_all();
+	}
+
+	// push multiple elements onto the queue, waits while the queue is full
+	void push_n (T* elem, size_t count) {
+		for (size_t i=0; i<count; ++i)
+			push(std::move(elem[i]));
+	}
+
+	// deque one element from the queue if there is one
+	// can be called from multiple threads (multiple consumer)
+	bool try_pop (T* out) {
+		Cell* cell;
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells[pos & mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+			if (dif == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0) {
+				return false; // empty
+			}
+			else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		*out = std::move(cell->val);
+		cell->seq.store(pos + mask + 1, std::memory_order_release);
+
+		_wake(not_full_event, waiting_producers);
+		return true;
+	}
+
+	// wait to dequeue one element from the queue
+	// can be called from multiple threads (multiple consumer)
+	T pop_wait () {
+		T val;
+		while (!try_pop(&val)) {
+			_wait(not_empty_event, waiting_consumers, [this] () { return !empty(); });
+		}
+		return val;
+	}
+
+	// dequeue up to max elements (or none); never waits
+	// writes the elements into their repective indicies in output
+	// returns the number of elements dequeued
+	size_t pop_n (T output[], size_t max) {
+		size_t count = 0;
+		while (count < max && try_pop(&output[count]))
+			count++;
+		return count;
+	}
+
+	// dequeue all elements (including none); never waits
+	// returns the number of elements dequeued
+	size_t pop_all (std::vector<T>* output) {
+		size_t count = 0;
+		T val;
+		while (try_pop(&val)) {
+			output->emplace_back(std::move(val));
+			count++;
+		}
+		return count;
+	}
+
+	// wait to dequeue one element from the queue or until shutdown is set
+	// returns if element was popped or shutdown was set as enum
+	// can be called from multiple threads (multiple consumer)
+	enum PopOrShutdown { POP, SHUTDOWN, WOKEN };
+	PopOrShutdown pop_or_shutdown_wait (T* out) {
+		return pop_or_shutdown_wait(out, [] () { return false; });
+	}
+
+	// like pop_or_shutdown_wait, but also returns WOKEN (without popping) once template callback 'bool wake ()' returns true
+	// whoever makes wake() true needs to call wake_waiters() afterwards
+	template <typename WAKE>
+	PopOrShutdown pop_or_shutdown_wait (T* out, WAKE wake) {
+		for (;;) {
+			if (shutdown_flag.load(std::memory_order_acquire))
+				return SHUTDOWN;
+			if (try_pop(out))
+				return POP;
+			if (wake())
+				return WOKEN;
+
+			_wait(not_empty_event, waiting_consumers, [&] () {
+				return shutdown_flag.load(std::memory_order_relaxed) || !empty() || wake();
+			});
+		}
+	}
+
+	// wake all threads waiting in pop_or_shutdown_wait so they recheck their wake callback
+	void wake_waiters () {
+		not_empty_event.fetch_add(1, std::memory_order_release);
+		not_empty_event.notify_all();
+	}
+
+	// set shutdown which all consumers can recieve via pop_or_shutdown
+	void shutdown () {
+		shutdown_flag.store(true, std::memory_order_release);
+		wake_waiters();
+	}
+	void reset_shutdown () {
+		shutdown_flag.store(false, std::memory_order_relaxed);
+	}
+
+	void clear () {
+		T val;
+		while (try_pop(&val))
+			;
+	}
+};
@@ -21,5 +21,64 @@
 		void sleep_msec (uint32_t msecs) {
 			Sleep((DWORD)msecs);
 		}
+
+	#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+		#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+	#endif
+
+		void sleep_until (uint64_t timestamp) {
+			// high resolution timers (win10 1803+) wake up within ~0.5ms, unlike Sleep which depends on the system timer resolution
+			static thread_local HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+
+			for (;;) {
+				uint64_t now = get_timestamp();
+				if (now >= timestamp)
+					return;
+
+				// relative due time in 100ns units
+				LARGE_INTEGER due;
+				due.QuadPart = -(LONGLONG)((timestamp - now) * 10000000ull / timestamp_freq);
+				if (due.QuadPart == 0)
+					return;
+
+				if (timer && SetWaitableTimerEx(timer, &due, 0, NULL, NULL, NULL, 0)) {
+					WaitForSingleObject(timer, INFINITE);
+				}
+				else {
+					// older windows, fall back to coarse sleeps
+					DWORD msecs = (DWORD)(-due.QuadPart / 10000);
+					Sleep(msecs > 0 ? msecs : 1);
+				}
+			}
+		}
+	}
+#elif defined(__linux__)
+	#include <time.h>
+
+	namespace kiss {
+		// nanosecond timestamps, so timestamp_freq is constant
+		uint64_t get_timestamp () {
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+		}
+
+		uint64_t timestamp_freq = 1000000000ull;
+
+		void sleep_msec (uint32_t msecs) {
+			timespec ts;
+			ts.tv_sec = msecs / 1000;
+			ts.tv_nsec = (long)(msecs % 1000) * 1000000;
+			while (nanosleep(&ts, &ts) != 0)
+				; // interrupted by signal, sleep for the remaining time
+		}
+
+		void sleep_until (uint64_t timestamp) {
+			timespec ts;
+			ts.tv_sec = (time_t)(timestamp / 1000000000ull);
+			ts.tv_nsec = (long)(timestamp % 1000000000ull);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0)
+				; // interrupted by signal, absolute deadline so just retry
+		}
 	}
 #endif
@@ -6,6 +6,9 @@ namespace kiss {
 	extern uint64_t timestamp_freq;
 
 	void sleep_msec (uint32_t msecs);
+	// sleep until get_timestamp() >= timestamp, precise to well below a millisecond (unlike sleep_msec)
+	// for timed waits like fixed rate threads, returns immediately if timestamp already passed
+	void sleep_until (uint64_t timestamp);
 
 	struct Timer {
 		uint64_t begin;
@@ -0,0 +1,478 @@
+#include "tlsf_allocator.hpp"
+
+typedef TlsfAllocator::Block Block;
+
+static uint32_t _msb (size_t val) {
+	return _bsr_0(~(uint64_t)val);
+}
+
+//// Thread caches
+// protects TlsfAllocator::caches and ThreadCache::owner, so that threads exiting and allocators being destroyed don't race
+static std::mutex _cache_registry_mutex;
+
+// counters of a ThreadCache are only written by its thread, a plain load and store is enough
+template <typename T>
+static void _add (std::atomic<T>& counter, T val) {
+	counter.store(counter.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+}
+
+static void _reset_cache (TlsfAllocator::ThreadCache& cache) {
+	cache.owner = nullptr;
+	for (int bin=0; bin<TlsfAllocator::CACHE_BINS; ++bin) {
+		cache.bins[bin] = nullptr;
+		cache.counts[bin] = 0;
+	}
+	cache.bytes = 0;
+	cache.allocs = 0;
+	cache.frees = 0;
+}
+
+struct _TlsfThreadCaches {
+	TlsfAllocator::ThreadCache caches[TlsfAllocator::MAX_CACHED_ALLOCATORS];
+
+	~_TlsfThreadCaches () {
+		// thread exits, give all blocks back
+		std::lock_guard lock(_cache_registry_mutex);
+		for (auto& cache : caches) {
+			if (!cache.owner) continue;
+
+			auto* owner = cache.owner;
+			for (int bin=0; bin<TlsfAllocator::CACHE_BINS; ++bin)
+				owner->_flush_cache(cache, bin, 0);
+
+			{
+				std::lock_guard lock(owner->mutex);
+				owner->alloc_count += cache.allocs.load(std::memory_order_relaxed);
+				owner->free_count += cache.frees.load(std::memory_order_relaxed);
+			}
+
+			auto& list = owner->caches;
+			list.erase(std::find(list.begin(), list.end(), &cache));
+			_reset_cache(cache);
+		}
+	}
+};
+static thread_local _TlsfThreadCaches _thread_caches;
+
+TlsfAllocator::ThreadCache* TlsfAllocator::_get_cache () {
+	auto& tc = _thread_caches;
+	for (auto& cache : tc.caches) {
+		if (cache.owner == this)
+			return &cache;
+	}
+	for (auto& cache : tc.caches) {
+		if (!cache.owner) {
+			std::lock_guard lock(_cache_registry_mutex);
+			cache.owner = this;
+			caches.push_back(&cache);
+			return &cache;
+		}
+	}
+	return nullptr;
+}
+
+// return blocks of a bin until keep are left
+void TlsfAllocator::_flush_cache (ThreadCache& cache, int bin, int keep) {
+	if (cache.counts[bin] <= keep) return;
+
+	std::lock_guard lock(mutex);
+	while (cache.counts[bin] > keep) {
+		void* ptr = cache.bins[bin];
+		cache.bins[bin] = *(void**)ptr;
+		cache.counts[bin]--;
+
+		_add(cache.bytes, (size_t)0 - usable_size(ptr));
+		_free_locked(ptr);
+	}
+}
+
+void TlsfAllocator::flush_thread_cache () {
+	auto& tc = _thread_caches;
+	for (auto& cache : tc.caches) {
+		if (cache.owner == this) {
+			for (int bin=0; bin<CACHE_BINS; ++bin)
+				_flush_cache(cache, bin, 0);
+		}
+	}
+}
+
+//// Allocator
+TlsfAllocator::TlsfAllocator (size_t max_size, RetentionPolicy policy) {
+	page_size = (size_t)os_page_size;
+	max_size = round_up_to_granularity(max_size, page_size);
+
+	base = (char*)reserve_address_space(max_size);
+	top = base;
+	commit_end = base;
+	reserve_end = base + max_size;
+	retention.policy = policy;
+}
+TlsfAllocator::~TlsfAllocator () {
+	{
+		// allocations that were never freed
+		auto s = stats();
+		MEMTRACK_FREE_N(tag, s.used - s.cached, s.allocs - s.frees);
+	}
+	{
+		// caches of threads that are still running now point to released memory, forget them
+		std::lock_guard lock(_cache_registry_mutex);
+		for (auto* cache : caches) {
+			_reset_cache(*cache);
+		}
+	}
+	release_address_space(base, reserve_end - base);
+}
+
+void TlsfAllocator::_mapping (size_t size, int* fl, int* sl) {
+	if (size < SMALL_SIZE) {
+		*fl = 0;
+		*sl = (int)(size / (SMALL_SIZE / SL_COUNT));
+	}
+	else {
+		int f = (int)_msb(size);
+		*sl = (int)(size >> (f - SL_LOG2)) ^ SL_COUNT;
+		*fl = f - (FL_SHIFT - 1);
+	}
+}
+
+void TlsfAllocator::_insert (Block* block) {
+	size_t size = block->size & ~BLOCK_FLAGS;
+	int fl, sl;
+	_mapping(size, &fl, &sl);
+	assert(fl < FL_COUNT);
+
+	Block* head = heads[fl][sl];
+	block->next_free = head;
+	block->prev_free = nullptr;
+	if (head) head->prev_free = block;
+	heads[fl][sl] = block;
+
+	fl_bitmap |= 1ull << fl;
+	sl_bitmap[fl] |= 1u << sl;
+
+	free_bytes += size;
+	free_blocks++;
+}
+
+void TlsfAllocator::_remove (Block* block) {
+	size_t size = block->size & ~BLOCK_FLAGS;
+	int fl, sl;
+	_mapping(size, &fl, &sl);
+
+	if (block->prev_free) block->prev_free->next_free = block->next_free;
+	else                  heads[fl][sl] = block->next_free;
+	if (block->next_free) block->next_free->prev_free = block->prev_free;
+
+	if (!heads[fl][sl]) {
+		sl_bitmap[fl] &= ~(1u << sl);
+		if (!sl_bitmap[fl])
+			fl_bitmap &= ~(1ull << fl);
+	}
+
+	free_bytes -= size;
+	free_blocks--;
+}
+
+// find a free block of at least size, does not remove it
+Block* TlsfAllocator::_find_free (size_t size) {
+	// round up to the next size class, so that every block in the found list is large enough
+	if (size >= SMALL_SIZE)
+		size += ((size_t)1 << (_msb(size) - SL_LOG2)) - 1;
+
+	int fl, sl;
+	_mapping(size, &fl, &sl);
+	if (fl >= FL_COUNT)
+		return nullptr;
+
+	uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+	if (!sl_map) {
+		uint64_t fl_map = fl + 1 < 64 ? fl_bitmap & (~0ull << (fl + 1)) : 0;
+		if (!fl_map)
+			return nullptr;
+		fl = (int)_bsf_1(fl_map);
+		sl_map = sl_bitmap[fl];
+	}
+	sl = (int)_bsf_1(sl_map);
+	return heads[fl][sl];
+}
+
+// carve a used block from the top, committing pages as needed
+Block* TlsfAllocator::_grow_top (size_t size) {
+	char* end = top + HEADER_SIZE + size;
+	if (end > reserve_end)
+		return nullptr;
+
+	if (end > commit_end) {
+		char* new_commit = (char*)round_up_to_granularity((uintptr_t)end, page_size);
+		commit_pages(commit_end, new_commit - commit_end);
+		commit_end = new_commit;
+		retention.commit_calls++;
+	}
+
+	// block before top is never free, so no BLOCK_PREV_FREE
+	Block* block = (Block*)top;
+	block->size = size;
+	top = end;
+	return block;
+}
+
+// mark block used, split off the remainder if large enough for another block
+void TlsfAllocator::_split (Block* block, size_t size) {
+	size_t block_size = block->size & ~BLOCK_FLAGS;
+	block->size &= ~BLOCK_FREE;
+
+	if (block_size >= size + HEADER_SIZE + MIN_PAYLOAD) {
+		Block* rest = (Block*)((char*)block + HEADER_SIZE + size);
+		Block* next = _next(block);
+		block->size = size | (block->size & BLOCK_PREV_FREE);
+
+		if ((char*)next == top) {
+			// block came from _grow_top, give the rest back to the top
+			top = (char*)rest;
+			return;
+		}
+		rest->size = (block_size - size - HEADER_SIZE) | BLOCK_FREE;
+
+		// block was free, so the one after it is used and can't be merged with rest
+		next->prev_phys = rest;
+		next->size |= BLOCK_PREV_FREE;
+		_insert(rest);
+	}
+	else {
+		Block* next = _next(block);
+		if ((char*)next != top)
+			next->size &= ~BLOCK_PREV_FREE;
+	}
+}
+
+void* TlsfAllocator::_alloc_locked (size_t size, size_t align) {
+	size = std::max(round_up_to_granularity(size, ALIGN), MIN_PAYLOAD);
+
+	if (align <= ALIGN) {
+		Block* block = _find_free(size);
+		if (block) {
+			_remove(block);
+			_split(block, size);
+		}
+		else {
+			block = _grow_top(size);
+			if (!block) return nullptr;
+		}
+		used_bytes += block->size & ~BLOCK_FLAGS;
+		return (char*)block + HEADER_SIZE;
+	}
+
+	// over-allocate and split off a free block in front to align the payload
+	size_t search = size + align + HEADER_SIZE + MIN_PAYLOAD;
+	Block* block = _find_free(search);
+	if (block) {
+		_remove(block);
+		block->size &= ~BLOCK_FREE;
+	}
+	else {
+		block = _grow_top(search);
+		if (!block) return nullptr;
+	}
+	// block is used now, next block's BLOCK_PREV_FREE is cleared by the _split below
+
+	char* payload = (char*)block + HEADER_SIZE;
+	size_t gap = round_up_to_granularity((uintptr_t)payload, align) - (uintptr_t)payload;
+	if (gap > 0 && gap < HEADER_SIZE + MIN_PAYLOAD)
+		gap += align; // front block needs to be large enough to be a block (align > ALIGN so this is enough)
+
+	if (gap > 0) {
+		Block* aligned = (Block*)((char*)block + gap);
+		aligned->size = ((block->size & ~BLOCK_FLAGS) - gap) | BLOCK_PREV_FREE;
+		aligned->prev_phys = block;
+
+		block->size = (gap - HEADER_SIZE) | (block->size & BLOCK_PREV_FREE) | BLOCK_FREE;
+		// block before this one is used (free blocks are always merged), so the front block can be inserted as is
+		// unless it was free itself, which _find_free'd blocks never are, and the block before top never is
+		_insert(block);
+
+		block = aligned;
+	}
+
+	_split(block, size);
+	used_bytes += block->size & ~BLOCK_FLAGS;
+	return (char*)block + HEADER_SIZE;
+}
+
+void TlsfAllocator::_free_locked (void* ptr) {
+	Block* block = (Block*)((char*)ptr - HEADER_SIZE);
+	assert(!(block->size & BLOCK_FREE));
+
+	used_bytes -= block->size & ~BLOCK_FLAGS;
+	block->size |= BLOCK_FREE;
+
+	// merge with previous
+	if (block->size & BLOCK_PREV_FREE) {
+		Block* prev = block->prev_phys;
+		_remove(prev);
+		prev->size += HEADER_SIZE + (block->size & ~BLOCK_FLAGS);
+		block = prev;
+	}
+
+	// merge with next
+	Block* next = _next(block);
+	if ((char*)next != top && (next->size & BLOCK_FREE)) {
+		_remove(next);
+		block->size += HEADER_SIZE + (next->size & ~BLOCK_FLAGS);
+		next = _next(block);
+	}
+
+	if ((char*)next == top) {
+		// last block, give it back to the top
+		retention.update_high_water(top - base);
+		top = (char*)block;
+		_shrink_top();
+		return;
+	}
+
+	next->prev_phys = block;
+	next->size |= BLOCK_PREV_FREE;
+	_insert(block);
+}
+
+void TlsfAllocator::_shrink_top () {
+	size_t committed = commit_end - base;
+	if ((size_t)(top - base) + page_size > committed)
+		return;
+
+	size_t target = retention.shrink_to(top - base, committed, page_size);
+	if (target < committed) {
+		decommit_pages(base + target, committed - target);
+		commit_end = base + target;
+	}
+}
+
+void* TlsfAllocator::alloc (size_t size, size_t align) {
+	ALLOCATOR_PROFILE_SCOPED("TlsfAllocator::alloc");
+	assert(align > 0 && (align & (align-1)) == 0);
+
+	void* ptr = nullptr;
+	ThreadCache* cache = nullptr;
+	if (size <= CACHE_MAX_SIZE && align <= ALIGN) {
+		// round up to the bin size, so that the block can go back to the same bin
+		int bin = (int)((std::max(size, (size_t)1) - 1) / ALIGN);
+		size = (size_t)(bin + 1) * ALIGN;
+
+		cache = _get_cache();
+		if (cache) {
+			_add(cache->allocs, (uint64_t)1);
+			if (cache->counts[bin] > 0) {
+				ptr = cache->bins[bin];
+				cache->bins[bin] = *(void**)ptr;
+				cache->counts[bin]--;
+				_add(cache->bytes, (size_t)0 - usable_size(ptr));
+			}
+		}
+	}
+
+	if (!ptr) {
+		std::lock_guard lock(mutex);
+		if (!cache) alloc_count++;
+		ptr = _alloc_locked(size, align);
+	}
+
+	if (ptr) {
+		ALLOCATOR_PROFILE_ALLOC(ptr, size);
+		MEMTRACK_ALLOC(tag, usable_size(ptr));
+	}
+	return ptr;
+}
+
+void TlsfAllocator::free (void* ptr) {
+	ALLOCATOR_PROFILE_SCOPED("TlsfAllocator::free");
+	if (!ptr) return;
+
+	ALLOCATOR_PROFILE_FREE(ptr);
+
+	size_t size = usable_size(ptr);
+	MEMTRACK_FREE(tag, size);
+	if (size <= CACHE_MAX_SIZE) {
+		// largest bin the block can serve
+		int bin = (int)(size / ALIGN) - 1;
+
+		if (auto* cache = _get_cache()) {
+			if (cache->counts[bin] >= CACHE_MAX_COUNT)
+				_flush_cache(*cache, bin, CACHE_MAX_COUNT / 2);
+
+			*(void**)ptr = cache->bins[bin];
+			cache->bins[bin] = ptr;
+			cache->counts[bin]++;
+			_add(cache->bytes, size);
+			_add(cache->frees, (uint64_t)1);
+			return;
+		}
+	}
+
+	std::lock_guard lock(mutex);
+	free_count++;
+	_free_locked(ptr);
+}
+
+void TlsfAllocator::set_tag (MemTag new_tag) {
+	auto s = stats();
+	MEMTRACK_FREE_N(tag, s.used - s.cached, s.allocs - s.frees);
+	MEMTRACK_ALLOC_N(new_tag, s.used - s.cached, s.allocs - s.frees);
+	tag = new_tag;
+}
+
+void TlsfAllocator::decay () {
+	std::lock_guard lock(mutex);
+	_shrink_top();
+}
+
+void TlsfAllocator::trim () {
+	std::lock_guard lock(mutex);
+
+	size_t committed = commit_end - base;
+	size_t target = retention.shrink_to(top - base, committed, page_size, true);
+	if (target < committed) {
+		decommit_pages(base + target, committed - target);
+		commit_end = base + target;
+	}
+}
+
+TlsfAllocator::Stats TlsfAllocator::stats () {
+	std::lock_guard reg_lock(_cache_registry_mutex);
+	std::lock_guard lock(mutex);
+
+	Stats s = {};
+	s.committed = commit_end - base;
+	s.used = used_bytes;
+	s.free = free_bytes;
+	s.free_blocks = free_blocks;
+	s.allocs = alloc_count;
+	s.frees = free_count;
+	for (auto* cache : caches) {
+		s.cached += cache->bytes.load(std::memory_order_relaxed);
+		s.allocs += cache->allocs.load(std::memory_order_relaxed);
+		s.frees += cache->frees.load(std::memory_order_relaxed);
+	}
+	s.commit_calls = retention.commit_calls;
+	s.decommit_calls = retention.decommit_calls;
+
+	if (fl_bitmap) {
+		int fl = (int)_msb(fl_bitmap);
+		int sl = (int)_msb(sl_bitmap[fl]);
+		for (Block* b = heads[fl][sl]; b; b = b->next_free)
+			s.largest_free = std::max(s.largest_free, b->size & ~BLOCK_FLAGS);
+	}
+	return s;
+}
+
+static std::atomic<TlsfAllocator*> _default_tlsf_allocator = nullptr;
+
+TlsfAllocator& get_default_tlsf_allocator () {
+	static TlsfAllocator allocator (64*GB);
+	_default_tlsf_allocator.store(&allocator, std::memory_order_relaxed);
+	return allocator;
+}
+void decay_default_tlsf_allocator () {
+	// don't create it (and reserve 64GB of address space) just to decay it
+	auto* allocator = _default_tlsf_allocator.load(std::memory_order_relaxed);
+	if (allocator)
+		allocator->decay();
+}
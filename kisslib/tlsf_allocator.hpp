@@ -0,0 +1,183 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+#include "allocator.hpp"
+
+// General purpose allocator for variable sized long-lived data (meshes, strings, vertex arrays) on reserved virtual memory
+// Two-Level Segregated Fit: free blocks are kept in lists by size class (power of two, subdivided into 32 linear steps),
+// two levels of bitmaps find a large enough free list with two bitscans, so alloc and free are O(1) and fragmentation stays low
+// blocks are carved from one contiguous reserved region, free blocks at the end are given back to the top and decommitted (see RetentionPolicy)
+// small allocations (<= CACHE_MAX_SIZE) go through per-thread caches, so most allocs and frees don't take the lock
+// everything is threadsafe
+/* pattern:
+	TlsfAllocator meshes (16*GB);
+	void* ptr = meshes.alloc(size);
+	meshes.free(ptr);
+
+	std::vector<Vertex, TlsfStdAllocator<Vertex>> verts; // uses get_default_tlsf_allocator()
+*/
+class TlsfAllocator {
+	NO_MOVE_COPY_CLASS(TlsfAllocator)
+public:
+	static constexpr size_t	ALIGN = 16;
+	static constexpr int	SL_LOG2 = 5; // 32 linear subdivisions per power of two
+	static constexpr int	SL_COUNT = 1 << SL_LOG2;
+	static constexpr int	FL_SHIFT = SL_LOG2 + 4; // sizes below 2^FL_SHIFT use linear ALIGN steps
+	static constexpr size_t	SMALL_SIZE = (size_t)1 << FL_SHIFT;
+	static constexpr int	FL_MAX = 40; // 1TB max block
+	static constexpr int	FL_COUNT = FL_MAX - FL_SHIFT + 1;
+
+	// size classes of the thread caches are multiples of ALIGN up to this
+	static constexpr size_t	CACHE_MAX_SIZE = 1024;
+	static constexpr int	CACHE_BINS = (int)(CACHE_MAX_SIZE / ALIGN);
+	static constexpr int	CACHE_MAX_COUNT = 32; // per bin, half of it is returned once full
+	// per thread only this many allocators have caches, further ones always take the lock
+	static constexpr int	MAX_CACHED_ALLOCATORS = 4;
+
+	struct Block {
+		Block*	prev_phys; // previous block in memory, only valid if PREV_FREE
+		size_t	size; // payload size | flags
+		// payload starts here, free blocks store their free list links in it
+		Block*	next_free;
+		Block*	prev_free;
+	};
+	static constexpr size_t BLOCK_FREE = 1;
+	static constexpr size_t BLOCK_PREV_FREE = 2;
+	static constexpr size_t BLOCK_FLAGS = BLOCK_FREE | BLOCK_PREV_FREE;
+	static constexpr size_t HEADER_SIZE = offsetof(Block, next_free);
+	static constexpr size_t MIN_PAYLOAD = sizeof(Block) - HEADER_SIZE;
+
+	struct ThreadCache {
+		TlsfAllocator*	owner = nullptr;
+		void*			bins[CACHE_BINS] = {}; // singly linked via the first word of the payload
+		uint8_t			counts[CACHE_BINS] = {};
+
+		// only written by the owning thread, so the fast path needs no atomic read-modify-write
+		std::atomic<size_t>		bytes = 0;
+		std::atomic<uint64_t>	allocs = 0;
+		std::atomic<uint64_t>	frees = 0;
+	};
+
+	struct Stats {
+		size_t		committed;
+		size_t		used; // allocated payload bytes, including blocks in thread caches
+		size_t		cached; // bytes in thread caches
+		size_t		free; // bytes in free blocks (not counting the uncommitted top)
+		size_t		largest_free; // approximate (largest block of the highest free list)
+		size_t		free_blocks;
+		uint64_t	allocs;
+		uint64_t	frees;
+		uint64_t	commit_calls;
+		uint64_t	decommit_calls;
+
+		// 0 -> all free memory is in one block, 1 -> free memory is split into tiny blocks
+		float fragmentation () const { return free ? 1.0f - (float)largest_free / (float)free : 0.0f; }
+	};
+
+private:
+	std::mutex	mutex;
+
+	char*		base;
+	char*		top; // [base, top) is split into blocks, the last block is never free (it is merged into top instead)
+	char*		commit_end;
+	char*		reserve_end;
+	size_t		page_size;
+	CommitRetention retention;
+
+	uint64_t	fl_bitmap = 0;
+	uint32_t	sl_bitmap[FL_COUNT] = {};
+	Block*		heads[FL_COUNT][SL_COUNT] = {};
+
+	size_t		used_bytes = 0;
+	size_t		free_bytes = 0;
+	size_t		free_blocks = 0;
+
+	// allocs and frees that did not go through a thread cache, plus those of exited threads
+	uint64_t	alloc_count = 0;
+	uint64_t	free_count = 0;
+
+	std::vector<ThreadCache*> caches; // registered thread caches, protected by the global cache registry mutex
+
+	MemTag		tag = MEMTAG_OTHER;
+
+	static void _mapping (size_t size, int* fl, int* sl);
+	Block* _find_free (size_t size);
+	void _insert (Block* block);
+	void _remove (Block* block);
+	Block* _next (Block* block) {
+		return (Block*)((char*)block + HEADER_SIZE + (block->size & ~BLOCK_FLAGS));
+	}
+	Block* _grow_top (size_t size);
+	void _split (Block* block, size_t size);
+	void _shrink_top ();
+
+	void* _alloc_locked (size_t size, size_t align);
+	void _free_locked (void* ptr);
+
+	ThreadCache* _get_cache ();
+	void _flush_cache (ThreadCache& cache, int bin, int keep);
+	friend struct _TlsfThreadCaches;
+
+public:
+	TlsfAllocator (size_t max_size, RetentionPolicy policy = { 4*MB, 5.0f });
+	~TlsfAllocator ();
+
+	// returns nullptr if max_size is reached, align needs to be a power of two
+	void* alloc (size_t size, size_t align=ALIGN);
+	// ptr may be nullptr
+	void free (void* ptr);
+
+	// usable bytes of an allocation (>= requested size)
+	size_t usable_size (void* ptr) {
+		return ((Block*)((char*)ptr - HEADER_SIZE))->size & ~BLOCK_FLAGS;
+	}
+
+	// category allocations count towards in g_mem_tracker (by usable_size), not threadsafe with concurrent allocs and frees
+	void set_tag (MemTag new_tag);
+
+	// return the blocks in the calling thread's cache
+	void flush_thread_cache ();
+	// decommit memory kept by the RetentionPolicy once it's decay_sec has passed, call this regularly (ie. once per frame)
+	// frees only check the RetentionPolicy when they give a block back to the top, so without this the retained high-water mark can stay committed forever
+	void decay ();
+	// decommit all unused pages at the top now, ignoring the RetentionPolicy
+	void trim ();
+
+	Stats stats ();
+};
+
+// process-wide allocator for TlsfStdAllocator, reserves 64GB of address space on first use
+TlsfAllocator& get_default_tlsf_allocator ();
+// decay() the default allocator, does nothing if it was never used, Engine calls this once per frame
+void decay_default_tlsf_allocator ();
+
+// drop-in replacement for std::allocator
+template <typename T>
+struct TlsfStdAllocator {
+	typedef T value_type;
+
+	TlsfStdAllocator () {}
+	template <typename U>
+	TlsfStdAllocator (TlsfStdAllocator<U> const&) {}
+
+	T* allocate (size_t n) {
+		void* ptr = get_default_tlsf_allocator().alloc(n * sizeof(T), std::max(alignof(T), TlsfAllocator::ALIGN));
+		if (!ptr) throw std::bad_alloc();
+		return (T*)ptr;
+	}
+	void deallocate (T* ptr, size_t) {
+		get_default_tlsf_allocator().free(ptr);
+	}
+
+	template <typename U>
+	bool operator== (TlsfStdAllocator<U> const&) const { return true; }
+	template <typename U>
+	bool operator!= (TlsfStdAllocator<U> const&) const { return false; }
+};
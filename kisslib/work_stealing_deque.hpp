@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <memory>
+#include "stdint.h"
+#include "assert.h"
+#include "macros.hpp"
+
+// Chase-Lev work-stealing deque
+// based on "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê, Pop, Cohen, Zappa Nardelli 2013)
+//
+// single owner thread push()es and pop()s at the bottom (LIFO, cache-hot), any other thread can steal() from the top (FIFO)
+// owner push/pop never take a lock and only contend with thieves when the deque is down to it's last item
+// T should be small and trivially copyable (usually a pointer)
+template <typename T>
+class WorkStealingDeque {
+	NO_MOVE_COPY_CLASS(WorkStealingDeque)
+
+	struct Array {
+		int64_t						mask; // capacity-1, capacity is a power of two
+		std::unique_ptr<std::atomic<T>[]>	buf;
+
+		Array (int64_t capacity): mask{capacity-1}, buf{ std::make_unique<std::atomic<T>[]>((size_t)capacity) } {
+			assert((capacity & (capacity-1)) == 0);
+		}
+
+		int64_t capacity () const { return mask+1; }
+
+		T get (int64_t i) const {
+			return buf[i & mask].load(std::memory_order_relaxed);
+		}
+		void put (int64_t i, T val) {
+			buf[i & mask].store(val, std::memory_order_relaxed);
+		}
+	};
+
+	// top and bottom are written by different threads, keep them on seperate cache lines
+	alignas(64) std::atomic<int64_t>	top = 0;
+	alignas(64) std::atomic<int64_t>	bottom = 0;
+	alignas(64) std::atomic<Array*>		array;
+
+	// thieves might still be reading from an old array after the owner grew the deque
+	// so simply keep them alive until the deque is destroyed (total size is bounded by 2x the largest array)
+	std::vector< std::unique_ptr<Array> > arrays;
+
+	Array* _grow (Array* a, int64_t b, int64_t t) {
+		auto new_arr = std::make_unique<Array>(a->capacity() * 2);
+		for (int64_t i=t; i<b; ++i)
+			new_arr->put(i, a->get(i));
+
+		Array* ptr = new_arr.get();
+		arrays.emplace_back(std::move(new_arr));
+
+		array.store(ptr, std::memory_order_release);
+		return ptr;
+	}
+
+public:
+	WorkStealingDeque (int64_t initial_capacity=256) {
+		arrays.emplace_back(std::make_unique<Array>(initial_capacity));
+		array.store(arrays.back().get(), std::memory_order_relaxed);
+	}
+
+	// only call from owner thread
+	void push (T val) {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		Array* a = array.load(std::memory_order_relaxed);
+
+		if (b - t > a->capacity() - 1) // full
+			a = _grow(a, b, t);
+
+		a->put(b, val);
+		bottom.store(b + 1, std::memory_order_release);
+	}
+
+	// only call from owner thread
+	// returns false if empty
+	bool pop (T* out) {
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		Array* a = array.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b) { // empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		*out = a->get(b);
+		if (t == b) {
+			// last item, race against thieves
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	// can be called from any thread
+	// returns false if empty or if we lost the race against another thief or the owner (caller can simply try another victim)
+	bool steal (T* out) {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+			return false; // empty
+
+		Array* a = array.load(std::memory_order_acquire);
+		T val = a->get(t);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return false; // lost race
+
+		*out = val;
+		return true;
+	}
+
+	// approximate, only useful for heuristics and debugging
+	int64_t size () const {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+};
@@ -3,6 +3,7 @@
 #include "glad/glad.h"
 #include "tracy/TracyOpenGL.hpp"
 #include "camera.hpp"
+#include "kisslib/memory_tracking.hpp"
 
 namespace ogl {
 //
@@ -340,6 +341,60 @@ using shader::Stage;
 
 inline shader::Shaders g_shaders;
 
+//
+//// gpu memory tracking
+//
+// sizes are only known once storage is allocated, so the upload functions track sizes by gl name and the wrapper destructors untrack them
+// sizes are approximate, the driver might pad formats (ie. RGB8 to RGBA8) or keep copies
+
+inline void track_gl_buffer (GLuint buf, size_t size, MemTag tag) {
+	MEMTRACK_RESOURCE(((uint64_t)GL_BUFFER << 32) | buf, tag, size);
+}
+inline void untrack_gl_buffer (GLuint buf) {
+	MEMTRACK_RESOURCE_FREE(((uint64_t)GL_BUFFER << 32) | buf);
+}
+inline void track_gl_texture (GLuint tex, size_t size, MemTag tag=MEMTAG_TEXTURES) {
+	MEMTRACK_RESOURCE(((uint64_t)GL_TEXTURE << 32) | tex, tag, size);
+}
+inline void untrack_gl_texture (GLuint tex) {
+	MEMTRACK_RESOURCE_FREE(((uint64_t)GL_TEXTURE << 32) | tex);
+}
+
+// bytes per texel of sized internal formats
+inline size_t gl_format_size (GLenum format) {
+	switch (format) {
+		case GL_R8: case GL_R8UI:
+			return 1;
+		case GL_RG8: case GL_R16: case GL_R16F: case GL_R16UI: case GL_DEPTH_COMPONENT16:
+			return 2;
+		case GL_RGB8: case GL_SRGB8: // usually padded to 4
+		case GL_RGBA8: case GL_SRGB8_ALPHA8: case GL_RG16: case GL_RG16F: case GL_R32F: case GL_R32UI:
+		case GL_R11F_G11F_B10F: case GL_RGB10_A2:
+		case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32: case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8:
+			return 4;
+		case GL_RGB16F: case GL_RGBA16F: case GL_RGBA16: case GL_RG32F: case GL_DEPTH32F_STENCIL8:
+			return 8;
+		case GL_RGB32F:
+			return 12;
+		case GL_RGBA32F:
+			return 16;
+		default:
+			return 4; // unknown, assume RGBA8
+	}
+}
+// texels of a 2d texture including its mips
+inline size_t gl_texels (int2 size, int levels=1) {
+	size_t texels = 0;
+	for (int i=0; i<levels; ++i) {
+		texels += (size_t)max(size.x >> i, 1) * (size_t)max(size.y >> i, 1);
+	}
+	return texels;
+}
+
+inline MemTag _gl_buffer_tag (GLenum target) {
+	return target == GL_ARRAY_BUFFER || target == GL_ELEMENT_ARRAY_BUFFER ? MEMTAG_MESHES : MEMTAG_OTHER;
+}
+
 //
 //// simple gl resource wrappers to avoid writing destructors manually all the time
 //
@@ -356,8 +411,10 @@ public:
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 	~Vbo () {
-		if (vbo)
+		if (vbo) {
+			untrack_gl_buffer(vbo);
 			glDeleteBuffers(1, &vbo);
+		}
 	}
 
 	operator GLuint () const { return vbo; }
@@ -375,7 +432,10 @@ public:
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
 	~Ebo () {
-		if (ebo) glDeleteBuffers(1, &ebo);
+		if (ebo) {
+			untrack_gl_buffer(ebo);
+			glDeleteBuffers(1, &ebo);
+		}
 	}
 
 	operator GLuint () const { return ebo; }
@@ -393,7 +453,10 @@ public:
 		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 	}
 	~Ubo () {
-		if (ubo) glDeleteBuffers(1, &ubo);
+		if (ubo) {
+			untrack_gl_buffer(ubo);
+			glDeleteBuffers(1, &ubo);
+		}
 	}
 
 	operator GLuint () const { return ubo; }
@@ -429,7 +492,10 @@ public:
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 	}
 	~Ssbo () {
-		if (ssbo) glDeleteBuffers(1, &ssbo);
+		if (ssbo) {
+			untrack_gl_buffer(ssbo);
+			glDeleteBuffers(1, &ssbo);
+		}
 	}
 
 	operator GLuint () const { return ssbo; }
@@ -462,7 +528,10 @@ public:
 		glGenTextures(1, &tex);
 	}
 	~TextureView () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -480,7 +549,10 @@ public:
 		glBindTexture(GL_TEXTURE_1D, 0);
 	}
 	~Texture1D () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -498,7 +570,10 @@ public:
 		glBindTexture(GL_TEXTURE_1D_ARRAY, 0);
 	}
 	~Texture1DArray () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -516,7 +591,10 @@ public:
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 	~Texture2D () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -534,7 +612,10 @@ public:
 		glBindTexture(GL_TEXTURE_3D, 0);
 	}
 	~Texture3D () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -552,7 +633,10 @@ public:
 		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 	}
 	~Texture2DArray () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -570,7 +654,10 @@ public:
 		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 	}
 	~TextureCubemap () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -606,7 +693,10 @@ public:
 		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	}
 	~UploadPbo () {
-		if (pbo) glDeleteBuffers(1, &pbo);
+		if (pbo) {
+			untrack_gl_buffer(pbo);
+			glDeleteBuffers(1, &pbo);
+		}
 	}
 
 	operator GLuint () const { return pbo; }
@@ -624,7 +714,10 @@ public:
 		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 	}
 	~DownloadPbo () {
-		if (pbo) glDeleteBuffers(1, &pbo);
+		if (pbo) {
+			untrack_gl_buffer(pbo);
+			glDeleteBuffers(1, &pbo);
+		}
 	}
 
 	operator GLuint () const { return pbo; }
@@ -644,6 +737,7 @@ public:
 			OGL_DBG_LABEL(GL_TEXTURE, tex, label);
 
 			glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, msaa, format, size.x, size.y, GL_TRUE);
+			track_gl_texture(tex, gl_texels(size) * gl_format_size(format) * msaa);
 			glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_BASE_LEVEL, 0);
 			glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_MAX_LEVEL, 0);
 			glTexParameterf(GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // Avoid supposed fbo incomplete error possible from this
@@ -656,6 +750,7 @@ public:
 			OGL_DBG_LABEL(GL_TEXTURE, tex, label);
 
 			glTexStorage2D(GL_TEXTURE_2D, levels, format, size.x, size.y);
+			track_gl_texture(tex, gl_texels(size, levels) * gl_format_size(format));
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels-1);
 			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -665,7 +760,10 @@ public:
 		}
 	}
 	~Render_Texture () {
-		if (tex) glDeleteTextures(1, &tex);
+		if (tex) {
+			untrack_gl_texture(tex);
+			glDeleteTextures(1, &tex);
+		}
 	}
 
 	operator GLuint () const { return tex; }
@@ -786,6 +884,8 @@ inline void upload_buffer (GLenum target, GLuint buf, size_t size, void const* d
 		glBufferData(target, size, data, usage);
 
 	glBindBuffer(target, 0);
+
+	track_gl_buffer(buf, size, _gl_buffer_tag(target));
 }
 // upload data to buffer via pointer in a streaming way (buffer orphaning)
 inline void stream_buffer (GLenum target, GLuint buf, size_t size, void const* data) {
@@ -1452,6 +1552,7 @@ template <typename T>
 inline void upload_image2D (GLuint tex, Image<T> const& img, bool gen_mips=true) {
 	glBindTexture(GL_TEXTURE_2D, tex);
 	_upload_texture2D(GL_TEXTURE_2D, img);
+	track_gl_texture(tex, gl_texels(img.size, gen_mips ? calc_mipmaps(img.size) : 1) * sizeof(T));
 
 	if (gen_mips) {
 		glGenerateMipmap(GL_TEXTURE_2D);
@@ -1469,6 +1570,7 @@ inline void upload_imageCube (GLuint tex, const Image<T> imgs[], bool gen_mips=t
 	for (int i=0; i<6; ++i) {
 		_upload_texture2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X+i, imgs[i]);
 	}
+	track_gl_texture(tex, gl_texels(imgs[0].size, gen_mips ? calc_mipmaps(imgs[0].size) : 1) * sizeof(T) * 6);
 	
 	if (gen_mips) {
 		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);